@@ -0,0 +1,223 @@
+#pragma once
+
+#include <atomic>               //std::atomic, std::memory_order_*
+#include <cstddef>              //std::size_t
+#include <cstdint>              //std::uint32_t, std::uint64_t
+#include <cstdio>               //std::snprintf
+#include <cstdlib>              //std::malloc, std::free, std::abort
+#include <new>                  //std::bad_alloc, std::align_val_t
+#include <unistd.h>             //write
+
+/*
+ * Opt-in heap allocation tracking.
+ *
+ * When compiled with `QUAKEOATS_ALLOC_TRACKING` defined, every allocation and
+ * deallocation going through the global operator new/delete gets counted, per
+ * thread. Without it, all of the functions in here are no-ops that report zero,
+ * so they can be left in hot paths.
+ *
+ * The replacement operators themselves are only defined in the translation unit
+ * that defines `QUAKEOATS_ALLOC_TRACKING_IMPL` before including this header, which
+ * must happen exactly once per executable.
+ */
+
+/**
+ * Allocation counters, either for a single thread or summed over all threads.
+ */
+struct alloc_counters {
+    std::uint64_t allocations = 0;
+    std::uint64_t deallocations = 0;
+    std::uint64_t bytes = 0;
+
+    alloc_counters operator-(const alloc_counters& rhs) const noexcept {
+        alloc_counters r;
+        r.allocations = allocations - rhs.allocations;
+        r.deallocations = deallocations - rhs.deallocations;
+        r.bytes = bytes - rhs.bytes;
+        return r;
+    }
+};
+
+namespace alloc_detail {
+    //maximum number of threads that get their own counters, threads past this
+    //limit all share the last slot
+    constexpr std::uint32_t MAX_THREADS = 256;
+
+    struct alignas(64) slot {
+        std::atomic<std::uint64_t> allocations { 0 };
+        std::atomic<std::uint64_t> deallocations { 0 };
+        std::atomic<std::uint64_t> bytes { 0 };
+    };
+
+    inline slot slots[MAX_THREADS];
+    inline std::atomic<std::uint32_t> next_slot { 0 };
+    inline thread_local slot* local_slot = nullptr;
+
+    //number of active `alloc_forbid_scope`s and whether they should be enforced
+    inline std::atomic<std::uint32_t> forbidden { 0 };
+    inline std::atomic<bool> asserting { false };
+
+    inline slot& current() noexcept {
+        if(local_slot == nullptr) {
+            auto i = next_slot.fetch_add(1, std::memory_order_relaxed);
+            local_slot = &slots[i < MAX_THREADS ? i : MAX_THREADS - 1];
+        }
+        return *local_slot;
+    }
+
+    inline void on_forbidden(std::size_t size) noexcept {
+        //can't use iostreams here, as they might allocate themselves
+        char msg[128];
+        int len = std::snprintf(msg, sizeof(msg),
+                "allocation of %zu bytes inside a zero-allocation scope\n", size);
+        if(len > 0) {
+            (void)!write(2, msg, (std::size_t)len);
+        }
+        std::abort();
+    }
+
+    inline void on_allocate(std::size_t size) noexcept {
+        auto& s = current();
+        s.allocations.fetch_add(1, std::memory_order_relaxed);
+        s.bytes.fetch_add(size, std::memory_order_relaxed);
+        if(forbidden.load(std::memory_order_relaxed) != 0
+                && asserting.load(std::memory_order_relaxed)) {
+            on_forbidden(size);
+        }
+    }
+
+    inline void on_deallocate() noexcept {
+        current().deallocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Returns whether allocation tracking was compiled in.
+ */
+constexpr bool alloc_tracking_enabled() noexcept {
+#ifdef QUAKEOATS_ALLOC_TRACKING
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Returns the counters of the current thread.
+ */
+inline alloc_counters alloc_thread_counters() noexcept {
+    alloc_counters r;
+    if(alloc_tracking_enabled()) {
+        auto& s = alloc_detail::current();
+        r.allocations = s.allocations.load(std::memory_order_relaxed);
+        r.deallocations = s.deallocations.load(std::memory_order_relaxed);
+        r.bytes = s.bytes.load(std::memory_order_relaxed);
+    }
+    return r;
+}
+
+/**
+ * Returns the counters summed over all threads. Counters of threads that have
+ * exited are kept, so the difference between two snapshots is always accurate.
+ */
+inline alloc_counters alloc_snapshot() noexcept {
+    alloc_counters r;
+    if(alloc_tracking_enabled()) {
+        auto n = alloc_detail::next_slot.load(std::memory_order_relaxed);
+        if(n > alloc_detail::MAX_THREADS) {
+            n = alloc_detail::MAX_THREADS;
+        }
+        for(std::uint32_t i = 0; i < n; i++) {
+            auto& s = alloc_detail::slots[i];
+            r.allocations += s.allocations.load(std::memory_order_relaxed);
+            r.deallocations += s.deallocations.load(std::memory_order_relaxed);
+            r.bytes += s.bytes.load(std::memory_order_relaxed);
+        }
+    }
+    return r;
+}
+
+/**
+ * Enables or disables the zero-allocation assertion. While enabled, any allocation,
+ * in any thread, that happens while an `alloc_forbid_scope` is alive prints the
+ * size of the allocation and aborts, so the offending stack can be inspected in a
+ * debugger. Does nothing unless allocation tracking was compiled in.
+ */
+inline void alloc_assert(bool enable) noexcept {
+    alloc_detail::asserting.store(enable, std::memory_order_relaxed);
+}
+
+/**
+ * Marks a region of code that is expected not to allocate. Only enforced while
+ * `alloc_assert` is enabled.
+ */
+class alloc_forbid_scope {
+private:
+    bool armed;
+
+    //prevent copying
+    alloc_forbid_scope(const alloc_forbid_scope&) = delete;
+    alloc_forbid_scope& operator=(const alloc_forbid_scope&) = delete;
+public:
+    explicit alloc_forbid_scope(bool arm = true) noexcept: armed(arm) {
+        if(armed) {
+            alloc_detail::forbidden.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    ~alloc_forbid_scope() {
+        if(armed) {
+            alloc_detail::forbidden.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+#if defined(QUAKEOATS_ALLOC_TRACKING) && defined(QUAKEOATS_ALLOC_TRACKING_IMPL)
+void* operator new(std::size_t size) {
+    alloc_detail::on_allocate(size);
+    if(void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    alloc_detail::on_allocate(size);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept {
+    return ::operator new(size, tag);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    alloc_detail::on_allocate(size);
+    auto a = static_cast<std::size_t>(align);
+    if(void* p = std::aligned_alloc(a, (size + a - 1) / a * a)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return ::operator new(size, align);
+}
+
+void operator delete(void* p) noexcept {
+    if(p == nullptr) return;
+    alloc_detail::on_deallocate();
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept { ::operator delete(p); }
+void operator delete(void* p, std::size_t) noexcept { ::operator delete(p); }
+void operator delete[](void* p, std::size_t) noexcept { ::operator delete(p); }
+void operator delete(void* p, std::align_val_t) noexcept { ::operator delete(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { ::operator delete(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { ::operator delete(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { ::operator delete(p); }
+#endif
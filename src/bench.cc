@@ -0,0 +1,317 @@
+/* bench.cc - Headless benchmark. Runs the game for a fixed number of frames
+ * with scripted input, without ever opening a window, and reports how long
+ * every frame took, along with how many allocations it made. */
+#define QUAKEOATS_ALLOC_TRACKING_IMPL
+#include <glm/glm.hpp>		/* For placing cameras.		*/
+#include "alloc_utils.hpp"	/* For counting allocations.	*/
+#include "perf_utils.hpp"	/* For per-stage counters.		*/
+#include "thread_utils.hpp"	/* For the default concurrency.	*/
+#include "shm_utils.hpp"	/* For shared-memory output.	*/
+#include "stream_utils.hpp"	/* For streaming frames.		*/
+
+import <iostream>;
+import <string>;
+import <chrono>;
+import <vector>;
+import <algorithm>;
+import <cstring>;
+import <fstream>;
+import game;	/* For the game.			*/
+import gfx;		/* For the render statistics.	*/
+
+#define WIDTH  (640)	/* Frame buffer width in pixels.	*/
+#define HEIGHT (480)	/* Frame buffer height in pixels.	*/
+
+int main(int argc, char **argv)
+{
+	uint64_t frames = 600;
+	bool assert_alloc = false;
+	bool perf = false;
+	bool spans = false;
+	bool trace = false;
+	bool shadows = false;
+	std::string capture_path;
+	std::string shm_name;
+	int stream_port = -1;
+	uint32_t views = 1;
+	std::string still_path;
+	uint32_t still_width = 0;
+	uint32_t still_height = 0;
+	uint32_t min_threads = 1;
+	uint32_t max_threads = thread_pool::default_concurrency();
+
+	for(int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if(arg == "--frames" && i + 1 < argc)
+			frames = std::stoull(argv[++i]);
+		else if(arg == "--assert-alloc")
+			assert_alloc = true;
+		else if(arg == "--perf")
+			perf = true;
+		else if(arg == "--spans")
+			spans = true;
+		else if(arg == "--trace")
+			trace = true;
+		else if(arg == "--shadows")
+			trace = shadows = true;
+		else if(arg == "--capture" && i + 1 < argc)
+			capture_path = argv[++i];
+		else if(arg == "--shm" && i + 1 < argc)
+			shm_name = argv[++i];
+		else if(arg == "--stream" && i + 1 < argc)
+			stream_port = std::stoi(argv[++i]);
+		else if(arg == "--views" && i + 1 < argc)
+			views = std::stoul(argv[++i]);
+		else if(arg == "--still" && i + 2 < argc)
+		{
+			/* A size, such as 15360x8640, and where to write it to. */
+			std::string size = argv[++i];
+			auto x = size.find('x');
+			still_width  = std::stoul(size.substr(0, x));
+			still_height = x == std::string::npos ? 0 : std::stoul(size.substr(x + 1));
+			still_path = argv[++i];
+		}
+		else if(arg == "--threads" && i + 1 < argc)
+		{
+			/* Either a fixed count or a minimum and a maximum. */
+			std::string range = argv[++i];
+			auto comma = range.find(',');
+			min_threads = std::stoul(range.substr(0, comma));
+			max_threads = comma == std::string::npos
+				? min_threads
+				: std::stoul(range.substr(comma + 1));
+		}
+		else
+		{
+			std::cerr << "usage: " << argv[0];
+			std::cerr << " [--frames <n>] [--assert-alloc] [--perf]";
+			std::cerr << " [--spans] [--trace] [--shadows] [--capture <file>]";
+			std::cerr << " [--threads <n>[,<max>]] [--shm <name>]";
+			std::cerr << " [--stream <port>] [--views <n>]";
+			std::cerr << " [--still <width>x<height> <file>]" << std::endl;
+			return 1;
+		}
+	}
+
+	if(assert_alloc && !alloc_tracking_enabled())
+		std::cerr << "warning: allocation tracking was not compiled in, "
+			"rebuild with ALLOC_TRACKING=1" << std::endl;
+	alloc_assert(assert_alloc);
+
+	if(perf && !perf_enable())
+		std::cerr << "warning: could not open performance counters, "
+			"check /proc/sys/kernel/perf_event_paranoid" << std::endl;
+
+	if(min_threads == 0 || max_threads < min_threads)
+	{
+		std::cerr << "invalid thread range" << std::endl;
+		return 1;
+	}
+	if(views == 0 || views > WIDTH)
+	{
+		std::cerr << "invalid number of views" << std::endl;
+		return 1;
+	}
+
+	/* Stills get rendered a tile the size of the screen at a time, and
+	 * replace the benchmark. */
+	if(!still_path.empty())
+	{
+		if(still_width == 0 || still_height == 0)
+		{
+			std::cerr << "invalid still size" << std::endl;
+			return 1;
+		}
+
+		std::ofstream out(still_path, std::ios_base::out | std::ios_base::binary);
+		if(!out)
+		{
+			std::cerr << "could not open " << still_path << std::endl;
+			return 1;
+		}
+
+		game::Still still(WIDTH, HEIGHT, max_threads);
+		still.controller().spans(spans);
+		still.controller().trace(trace);
+		still.controller().shadows(shadows);
+
+		/* Where the player starts out, looking where the player does. */
+		game::View camera;
+		camera.position = glm::vec3(0.0, 2.0, 0.0);
+		camera.rotation = glm::vec3(0.0, 3.1415, 0.0);
+
+		auto begin = std::chrono::steady_clock::now();
+		bool ok = still.render(out, still_width, still_height, camera);
+		auto end = std::chrono::steady_clock::now();
+
+		if(!ok)
+		{
+			std::cerr << "could not write " << still_path << std::endl;
+			return 1;
+		}
+		std::cout << "still: " << still_width << "x" << still_height << " in "
+			<< std::chrono::duration<double, std::milli>(end - begin).count()
+			<< "ms" << std::endl;
+		return 0;
+	}
+
+	game::Game game(WIDTH, HEIGHT, min_threads, max_threads);
+
+	/* Split the screen into columns, the first of which follows the player,
+	 * while the others are spectator cameras looking every which way from
+	 * the middle of the map. */
+	if(views > 1)
+	{
+		std::vector<game::View> split;
+		for(uint32_t i = 0; i < views; ++i)
+		{
+			game::View view;
+			view.viewport = game::Scissor
+			{
+				.left   = (int32_t) (i * WIDTH / views),
+				.right  = (int32_t) ((i + 1) * WIDTH / views) - 1,
+				.top    = 0,
+				.bottom = HEIGHT - 1
+			};
+			view.follow   = i == 0;
+			view.position = glm::vec3(0.0, 2.0, 0.0);
+			view.rotation = glm::vec3(0.0, 6.2831 * i / views, 0.0);
+			split.push_back(view);
+		}
+		game.views(split);
+	}
+
+	std::ofstream capture;
+	if(!capture_path.empty())
+	{
+		if(assert_alloc)
+			std::cerr << "warning: capturing frames allocates, "
+				"expect --assert-alloc to trip" << std::endl;
+
+		capture.open(capture_path, std::ios_base::out | std::ios_base::binary);
+		if(!capture)
+		{
+			std::cerr << "could not open " << capture_path << std::endl;
+			return 1;
+		}
+		game.capture(&capture);
+	}
+
+	/* Frames either get rendered straight into a ring in shared memory, for
+	 * other processes to read, or there is no one to present them to, so
+	 * stand in for the window system by copying them out. */
+	frame_ring ring;
+	if(!shm_name.empty())
+	{
+		if(!ring.create(shm_name, WIDTH, HEIGHT, sizeof(game::Pixel)))
+		{
+			std::cerr << "could not create " << shm_name << std::endl;
+			return 1;
+		}
+		game.output(
+			[&ring]() { return static_cast<game::Pixel*>(ring.begin_write()); },
+			[&ring]() { ring.end_write(); });
+	}
+	std::vector<uint8_t> presented(WIDTH * HEIGHT * 4);
+
+	/* Frames can also be streamed to a spectator on the loopback interface,
+	 * which the game doesn't wait for, so frames it can't keep up with are
+	 * dropped. */
+	frame_streamer streamer(WIDTH, HEIGHT);
+	if(stream_port >= 0)
+	{
+		if(!streamer.listen("127.0.0.1", (uint16_t) stream_port))
+		{
+			std::cerr << "could not listen on port " << stream_port << std::endl;
+			return 1;
+		}
+		std::cerr << "streaming on port " << streamer.port() << std::endl;
+	}
+
+	/* Walk around in circles, so that the view changes every frame. */
+	game.controller().forward(true);
+	game.controller().left(true);
+	game.controller().spans(spans);
+	game.controller().trace(trace);
+	game.controller().shadows(shadows);
+
+	using Clock    = std::chrono::steady_clock;
+	using Duration = std::chrono::duration<double, std::milli>;
+
+	std::vector<double> times;
+	times.reserve(frames);
+
+	for(uint64_t i = 0; i < frames; ++i)
+	{
+		auto allocs = alloc_snapshot();
+		auto begin  = Clock::now();
+
+		game.iterate(1.0 / 60.0);
+		if(!ring.is_open())
+		{
+			perf_scope scope(perf_stage::present);
+			std::memcpy(presented.data(), game.get_screen().data(), presented.size());
+		}
+		if(stream_port >= 0)
+		{
+			perf_scope scope(perf_stage::present);
+			streamer.submit(game.workers(), game.get_screen().data());
+		}
+
+		auto end = Clock::now();
+		auto delta = alloc_snapshot() - allocs;
+
+		double time = std::chrono::duration_cast<Duration>(end - begin).count();
+		times.push_back(time);
+
+		const gfx::RasterStats& stats = game.render_stats();
+		std::cout << "frame " << i << ": " << time << "ms, "
+			<< stats.rasterized << "/" << stats.submitted << " triangles, "
+			<< stats.fragments << " fragments, "
+			<< game.render_threads() << " threads";
+		if(alloc_tracking_enabled())
+			std::cout << ", " << delta.allocations << " allocations ("
+				<< delta.bytes << " bytes)";
+		std::cout << std::endl;
+	}
+
+	if(times.empty())
+		return 0;
+
+	std::sort(times.begin(), times.end());
+	double total = 0.0;
+	for(auto time : times)
+		total += time;
+
+	std::cout << "frames: " << times.size() << std::endl;
+	std::cout << "mean:   " << total / times.size() << "ms" << std::endl;
+	std::cout << "median: " << times[times.size() / 2] << "ms" << std::endl;
+	std::cout << "p99:    " << times[times.size() * 99 / 100] << "ms" << std::endl;
+	std::cout << "max:    " << times.back() << "ms" << std::endl;
+
+	if(stream_port >= 0)
+	{
+		auto streamed = streamer.statistics();
+		std::cout << "streamed: " << streamed.sent << " frames, "
+			<< streamed.dropped << " dropped, "
+			<< streamed.bytes << " bytes" << std::endl;
+	}
+
+	if(perf_enabled())
+	{
+		std::cout << std::endl;
+		perf_report(std::cout);
+
+		std::cout << std::endl << "cycles per thread:" << std::endl;
+		for(uint32_t i = 0; i < perf_threads(); ++i)
+		{
+			uint64_t cycles = 0;
+			for(uint32_t j = 0; j < (uint32_t) perf_stage::count; ++j)
+				cycles += perf_stage_counters((perf_stage) j, i).cycles;
+			std::cout << "  thread " << i << ": " << cycles << std::endl;
+		}
+	}
+
+	return 0;
+}
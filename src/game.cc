@@ -2,13 +2,21 @@ module;
 #include <glm/glm.hpp>	/* For mathematics. */
 #include <glm/gtx/transform.hpp>
 #include "thread_utils.hpp"
+#include "alloc_utils.hpp"
+#include "perf_utils.hpp"
+#include "numa_utils.hpp"
+#include "log_utils.hpp"
 
 export module game;
 
 import <concepts>;	/* For standard concepts.		*/
 import <sstream>;	/* AAAAAAAAAAAAAAAAAAAAAAAAAAA.	*/
-import <fstream>;	/* For loading the map file.	*/
+import <memory>;	/* For sharing the map.			*/
 import <iostream>;	/* For debug output.			*/
+import <cstdio>;	/* For formatting the overlay.	*/
+import <chrono>;	/* For the frame budget.		*/
+import <atomic>;	/* For handing out tiles.		*/
+import <limits>;	/* For ray ranges.				*/
 import gfx;			/* For planes and rasterizers.	*/
 import map;			/* For asset loading.			*/
 import str;
@@ -84,6 +92,16 @@ export namespace game
 
 		/* Fire and chrouch. */
 		bool fre, cch;
+
+		/* Statistics overlay. */
+		bool ovl {};
+
+		/* Draw the world with span buffers rather than depth tests. */
+		bool spn {};
+
+		/* Trace rays through the world rather than rasterizing it, and
+		 * whether to trace shadow rays along with them. */
+		bool trc {}, shd {};
 	public:
 		int32_t mouse_x() const noexcept { return mx; }
 		int32_t mouse_y() const noexcept { return my; }
@@ -94,6 +112,10 @@ export namespace game
 		bool right()    const noexcept { return rht; }
 		bool fire()     const noexcept { return fre; }
 		bool crouch()   const noexcept { return cch; }
+		bool overlay()  const noexcept { return ovl; }
+		bool spans()    const noexcept { return spn; }
+		bool trace()    const noexcept { return trc; }
+		bool shadows()  const noexcept { return shd; }
 		
 		int32_t mouse_x_nudge(int32_t x) noexcept { return (mx += x); } 
 		int32_t mouse_y_nudge(int32_t y) noexcept { return (my += y); } 
@@ -107,9 +129,131 @@ export namespace game
 		bool right(bool v)    noexcept { return (rht = v); }
 		bool fire(bool v)     noexcept { return (fre = v); }
 		bool crouch(bool v)   noexcept { return (cch = v); }
+		bool overlay(bool v)  noexcept { return (ovl = v); }
+		bool spans(bool v)    noexcept { return (spn = v); }
+		bool trace(bool v)    noexcept { return (trc = v); }
+		bool shadows(bool v)  noexcept { return (shd = v); }
 
 	};
 
+	/* Screen space rectangle, with inclusive bounds, in pixels. */
+	struct Scissor
+	{
+		int32_t left;
+		int32_t right;
+		int32_t top;
+		int32_t bottom;
+
+		bool empty() const noexcept
+		{
+			return left > right || top > bottom;
+		}
+
+		/* Part of this rectangle also inside of the other one. */
+		Scissor intersection(const Scissor& other) const noexcept
+		{
+			return Scissor
+			{
+				.left   = std::max(left,   other.left),
+				.right  = std::min(right,  other.right),
+				.top    = std::max(top,    other.top),
+				.bottom = std::min(bottom, other.bottom)
+			};
+		}
+
+		/* Smallest rectangle containing both this and the other one. */
+		Scissor bounds(const Scissor& other) const noexcept
+		{
+			if(empty()) return other;
+			if(other.empty()) return *this;
+
+			return Scissor
+			{
+				.left   = std::min(left,   other.left),
+				.right  = std::max(right,  other.right),
+				.top    = std::min(top,    other.top),
+				.bottom = std::max(bottom, other.bottom)
+			};
+		}
+
+		bool operator ==(const Scissor& other) const noexcept = default;
+	};
+
+	/* Coordinates in screen space of the given point in projected space,
+	 * inside of the given viewport. */
+	std::tuple<int32_t, int32_t> to_screen(glm::vec4 p, const Scissor& viewport)
+	{
+		int32_t width  = viewport.right  - viewport.left + 1;
+		int32_t height = viewport.bottom - viewport.top  + 1;
+
+		int32_t x = std::round((p.x + 1.0) * (double) width  / 2.0);
+		int32_t y = std::round((p.y + 1.0) * (double) height / 2.0);
+		x = viewport.left + x;
+		y = viewport.top + height - y;
+
+		return std::make_tuple(x, y);
+	}
+
+	/* Depth in camera space portals get clipped at. Triangles are clipped
+	 * at a depth of one, but the cells beyond a portal can still be seen
+	 * through the part of it that is nearer than that, such as when walking
+	 * through a door, so portals only get clipped right in front of the eye,
+	 * where their projections would flip over. */
+	constexpr float PORTAL_NEAR = 1.0f / 64.0f;
+
+	/* Bounds on the screen of a portal with the given outline in world space,
+	 * seen by a camera with the given view and projection matrices, drawn
+	 * into the given viewport. The outline is clipped to the part in front
+	 * of the eye first, so portals that are entirely behind it come out
+	 * empty. */
+	Scissor project_portal(
+		const std::vector<glm::vec3>& outline,
+		const glm::mat4& view,
+		const glm::mat4& projection,
+		const Scissor& viewport)
+	{
+		Scissor bounds { 0, -1, 0, -1 };
+		if(outline.empty())
+			return bounds;
+
+		auto add = [&](glm::vec4 p)
+		{
+			p = projection * p;
+			p /= p.w;
+
+			/* Points right next to the eye project very far out, so keep
+			 * them in a range that can't overflow, which still covers the
+			 * viewport. */
+			p.x = std::clamp(p.x, -2.0f, 2.0f);
+			p.y = std::clamp(p.y, -2.0f, 2.0f);
+
+			auto [x, y] = to_screen(p, viewport);
+			bounds = bounds.bounds(Scissor { x, x, y, y });
+		};
+
+		/* Clip every edge of the outline against the plane in front of the
+		 * eye, keeping the points in front of it and the crossings. */
+		glm::vec4 a = view * glm::vec4(outline.back(), 1.0);
+		for(const auto& point : outline)
+		{
+			glm::vec4 b = view * glm::vec4(point, 1.0);
+
+			bool a_in = a.z >= PORTAL_NEAR;
+			bool b_in = b.z >= PORTAL_NEAR;
+			if(a_in != b_in)
+			{
+				float t = (PORTAL_NEAR - a.z) / (b.z - a.z);
+				add(a + t * (b - a));
+			}
+			if(b_in)
+				add(b);
+
+			a = b;
+		}
+
+		return bounds.intersection(viewport);
+	}
+
 	struct Player
 	{
 		glm::vec3 position;
@@ -118,12 +262,47 @@ export namespace game
 		glm::vec3 scaling;
 	};
 
+	/* A camera looking into the world, drawn into a rectangle of the
+	 * screen. */
+	struct View
+	{
+		/* Rectangle of the screen the view gets drawn into. */
+		Scissor viewport;
+
+		/* Whether the camera sits where the player is and looks where the
+		 * player looks, or stays where it was put. */
+		bool follow = true;
+
+		/* Position and rotation of the camera, for views that don't follow
+		 * the player. */
+		glm::vec3 position = glm::vec3(0.0);
+		glm::vec3 rotation = glm::vec3(0.0);
+
+		/* Vertical field of view, in radians. */
+		float fov = glm::radians(45.0f);
+
+		/* Width over height of the picture the view is part of, or zero to
+		 * take it from the viewport. */
+		float aspect = 0.0f;
+
+		/* Part of that picture the view shows, as the left, right, bottom and
+		 * top of it in normalized device coordinates, which go from -1 to +1
+		 * both ways. Anything but the whole picture makes for an off-center
+		 * frustum, such as for rendering a large picture a piece at a time. */
+		glm::vec4 window = glm::vec4(-1.0, 1.0, -1.0, 1.0);
+	};
+
 	class Game
 	{
 	protected:
-		/* World space to screen space transformation matrix. */
+		/* Camera space to screen space transformation matrix of the view
+		 * that is currently being drawn. */
 		glm::mat4 projection;
 
+		/* NUMA nodes of the machine, which the frame buffers and the workers
+		 * of the world rasterizer are placed on. */
+		numa_topology topology;
+
 		/* Ouput color screen buffer.
 		 * 
 		 * The backing storage of this buffer is aliased to the actual output 
@@ -148,40 +327,835 @@ export namespace game
 		/* Input map. */
 		Controller _controller;	
 
-		/* World map. */
-		map::Map world_map;
+		/* World map, which is shared with every other game on the same map,
+		 * and so must never be changed. */
+		std::shared_ptr<const map::Map> world_map;
 
 		/* Player variables. */
 		Player player;
+
+		/* Direction the player is heading in, in radians around the vertical
+		 * axis. */
+		double angle = 3.1415 / 2.0;
+
+		/* Number of frames rendered so far. */
+		uint64_t frames = 0;
+
+		/* World space to camera space transformation matrix of the view that
+		 * is currently being drawn. */
+		glm::mat4 view;
+
+		/* Rectangle of the screen the view that is currently being drawn
+		 * goes to. */
+		Scissor viewport;
+
+		/* Clip space transformation matrix moving the view that is currently
+		 * being drawn to its viewport. See `placement_of()`. */
+		glm::mat4 placement;
+
+		/* Views every frame is made of. */
+		std::vector<View> _views;
+
+		/* Everything about a view that gets worked out once per frame. */
+		struct ViewState
+		{
+			glm::mat4 projection;
+			glm::mat4 view;
+			Scissor viewport;
+
+			/* Position of the camera in world space, the rotation from camera
+			 * space to world space, and the inverse of the projection, for
+			 * tracing. */
+			glm::vec3 eye;
+			glm::mat3 camera;
+			glm::mat4 unproject;
+
+			/* Number of tiles in all of the views before this one. */
+			uint32_t first_tile;
+		};
+		std::vector<ViewState> _states;
+
+		/* Everything the functions used during setup need to know about
+		 * a model slice drawn in the current frame. */
+		struct DrawState
+		{
+			/* Model space to camera space transformation matrix of the
+			 * slice. Just the view, for static models. */
+			glm::mat4 model_view;
+
+			/* Camera space to projected space transformation matrix of the
+			 * view the slice is drawn in, already placed in its viewport. */
+			glm::mat4 projection;
+
+			/* Scissor rectangle the slice is limited to. */
+			Scissor clip;
+		};
+
+		/* State of every slice drawn in the current frame, in the frame
+		 * arena of the world raster, indexed by the draw of the triangles
+		 * being set up. Slices don't wait for each other to be set up, so
+		 * each one has its own state, rather than overwriting the last. */
+		DrawState *draws = nullptr;
+		uint32_t draw_count = 0;
+
+		/* Most slices a single view can draw, as every loose slice gets
+		 * drawn once, and every other one once for every cell it is in. */
+		uint32_t draws_per_view = 0;
+
+		/* Rectangle through which every cell of the map can be seen from
+		 * the camera in the current frame, empty for hidden cells. */
+		std::vector<Scissor> visible;
+
+		/* Cells whose visibility changed and still has to be propagated
+		 * through their portals, along with whether each cell is in there. */
+		std::vector<uint32_t> pending;
+		std::vector<uint8_t> queued;
+
+		/* Model slices that aren't inside of any cell, and thus always get
+		 * drawn. */
+		std::vector<uint32_t> loose;
+
+		/* Timer that writes out the log in the background. */
+		thread_pool::timer_id log_timer;
+
+		/* Hooks handing out the storage every frame gets rendered to, and
+		 * taking it back once the frame is done, if frames go anywhere other
+		 * than the game's own screen buffer. */
+		std::function<Pixel*()> _acquire;
+		std::function<void()>   _publish;
+
+		/* Next tile of the screen for a worker to trace. Tiles are handed out
+		 * as workers get done with them, rather than split up front, as some
+		 * take a lot longer to trace than others. */
+		std::atomic<uint32_t> next_tile;
+
+		/* Workers still tracing the current frame. */
+		wait_group tracing;
+
+		/* The job every worker runs to trace a frame, small enough to never
+		 * allocate. */
+		struct TraceJob
+		{
+			Game* game;
+
+			void operator()(uint32_t)
+			{
+				game->trace_tiles();
+				game->tracing.done();
+			}
+		} trace_job { this };
+	protected:
+		/* Set up the pipeline functions of the world rasterizer.
+		 *
+		 * This is done only once, rather than every frame, as the state these
+		 * functions depend on lives in the game, and assigning them would have
+		 * to allocate their closures. */
+		void setup_world()
+		{
+			world.transform = [this](map::Point p)
+			{
+				glm::vec4 point = current_draw().model_view * p.position;
+				p.position = point;
+
+				return p;
+			};
+			world.tesselation = [](
+				map::Point a, 
+				map::Point b, 
+				map::Point c, 
+				std::function<void(map::Point, map::Point, map::Point)> dispatch)
+			{
+				glm::vec3 q(0.0, 0.0, 1.0);
+				glm::vec3 n(0.0, 0.0, 1.0);
+				
+				auto ndot = [&](glm::vec3 p)
+				{
+					return glm::dot(n, p - q);
+				};
+
+				auto lncross = [&](glm::vec3 a, glm::vec3 b) -> std::optional<glm::vec3>
+				{
+					glm::vec3 v0 = a - q;
+					glm::vec3 v1 = b - q;
+
+					float d0 = glm::dot(n, v0);
+					float d1 = glm::dot(n, v1);
+
+					if(std::signbit(d0) == std::signbit(d1))
+						/* Line segment doesn't cross the plane. */
+						return {};
+
+					float t = d0 / (d1 - d0);
+					return a + t * (b - a);
+				};
+
+				auto lenrat = [](glm::vec3 a, glm::vec3 shrt, glm::vec3 lng)
+				{
+					float l = glm::length(lng  - a);
+					float s = glm::length(shrt - a);
+
+					return s / l;
+				};
+				
+				uint32_t trigs = 0;
+				map::Point points[4];
+
+				auto p_add = [&](map::Point a)
+				{
+					if(trigs >= 4)
+					{
+						static log_limiter limiter(std::chrono::seconds(1));
+						log_limited(limiter, log_level::warning,
+							"more than three points in triangle crossing");
+						return;
+					}
+					points[trigs++] = a;
+				};
+
+				auto p_lncross_test = [&](map::Point a, map::Point b)
+				{
+					std::optional<glm::vec3> ocross = lncross(
+						a.position.xyz(), 
+						b.position.xyz());
+					if(!ocross) return;
+					
+					glm::vec3 cross = ocross.value();
+					float midf = lenrat(
+						a.position.xyz(),
+						cross,
+						b.position.xyz());
+
+					map::PointSlope slope(a, b);
+					map::Point mid = slope.at(midf);
+
+					/* Passed the test. */
+					p_add(mid);
+				};
+				
+				uint32_t inside = 0;
+				auto test = [&](map::Point p)
+				{
+					if(ndot(p.position.xyz()) >= -0.0) 
+					{
+						p_add(p);
+						inside++;
+					}
+				};
+			
+				test(a);
+				p_lncross_test(a, b);
+				test(b);
+				p_lncross_test(b, c);
+				test(c);
+				p_lncross_test(c, a);
+
+				if(inside != 3)
+					gfx::Raster<map::Point, map::PointSlope>::local_stats().clipped++;
+
+				if(trigs == 3)
+				{
+					dispatch(points[0], points[1], points[2]);
+				}
+				else if(trigs == 4)
+				{
+					dispatch(points[0], points[1], points[2]);
+					dispatch(points[0], points[2], points[3]);
+				}
+				else if(trigs != 0)
+				{
+					static log_limiter limiter(std::chrono::seconds(1));
+					log_limited(limiter, log_level::warning,
+						"only valid trig values are 0, 3 and 4, got {}", trigs);
+				}
+
+			};
+			world.project = [this](map::Point p)
+			{
+				float z = p.position.z;
+				p.position = current_draw().projection * p.position;
+				p.position /= p.position.w;
+				p.position.z = z;
+
+				return p;
+			};
+			world.screen = [this](map::Point p)
+			{
+				return to_screen(p.position);
+			};
+			world.scissor = [this]()
+			{
+				const Scissor& clip = current_draw().clip;
+				return std::make_tuple(clip.left, clip.right, clip.top, clip.bottom);
+			};
+			world.slope = [](map::Point a, map::Point b)
+			{
+				return map::PointSlope(a, b);
+			};
+			world.painter = [this](uint32_t x, uint32_t y, map::Point p)
+			{
+				auto sampler = gfx::Sampler<gfx::PixelRgba32, gfx::PixelRgba32Slope>(
+					world_map->textures().at(p.texture_index),
+					[](gfx::PixelRgba32 a, gfx::PixelRgba32 b) {
+						return gfx::PixelRgba32Slope(a, b);
+					});
+
+				if(x < 0 || x >= screen.width()) return;
+				if(y < 0 || y >= screen.height()) return;
+
+				lock.at(x, y).lock();
+				if(depth.at(x, y) < p.position.z)
+				{
+					lock.at(x, y).unlock();
+					world.local_stats().rejected++;
+					return;
+				}
+				depth.at(x, y) = p.position.z;
+				shade(x, y, p);
+
+				lock.at(x, y).unlock();
+				world.local_stats().written++;
+			};
+			world.depth = [](map::Point p)
+			{
+				return p.position.z;
+			};
+			world.span_painter = [this](uint32_t y, uint32_t x0, uint32_t x1, map::Point p0, map::Point p1)
+			{
+				/* Spans are already known to be visible, and no other painter
+				 * can be touching their pixels, so neither the depth test nor
+				 * the locks are needed. The depth still gets written, for the
+				 * triangles that do get tested against it. */
+				map::PointSlope slope(p0, p1);
+				for(uint32_t x = x0; x < x1; ++x)
+				{
+					map::Point p = slope.at((double) (x - x0) / (double) (x1 - x0));
+					depth.at(x, y) = p.position.z;
+					shade(x, y, p);
+				}
+				world.local_stats().written += x1 - x0;
+			};
+		}
+
+		/* Coordinates in screen space of the given point in projected space.
+		 * Points get projected into the whole of the screen, whichever view
+		 * they're in, so this is the same for all of them. */
+		std::tuple<int32_t, int32_t> to_screen(glm::vec4 p) const
+		{
+			return game::to_screen(p, fullscreen());
+		}
+
+		/* Matrix that moves points in clip space from covering the given
+		 * rectangle of the screen to covering all of it, in the same spot.
+		 *
+		 * Every view is drawn by the same flush, which only maps points to
+		 * the screen once all of the views have been set up, so by then the
+		 * viewport of every view but the last is gone. Applying this during
+		 * projection leaves nothing about the view for that mapping to know.
+		 * Being affine, it doesn't change how points interpolate, and for
+		 * the whole screen it's the identity, so single views come out just
+		 * as before. */
+		glm::mat4 placement_of(const Scissor& rect) const
+		{
+			float width  = (float) screen.width();
+			float height = (float) screen.height();
+			float w = (float) (rect.right  - rect.left + 1);
+			float h = (float) (rect.bottom - rect.top  + 1);
+
+			/* Applied in clip space, so the offsets scale with W. */
+			glm::mat4 m = glm::mat4(1.0);
+			m[0][0] = w / width;
+			m[1][1] = h / height;
+			m[3][0] = (2.0f * (float) rect.left + w) / width - 1.0f;
+			m[3][1] = 1.0f - (2.0f * (float) rect.top + h) / height;
+
+			return m;
+		}
+
+		/* Scissor covering the whole screen. */
+		Scissor fullscreen() const
+		{
+			return Scissor
+			{
+				.left   = 0,
+				.right  = (int32_t) screen.width()  - 1,
+				.top    = 0,
+				.bottom = (int32_t) screen.height() - 1
+			};
+		}
+
+		/* Bounds of the given portal on the screen, as seen through the
+		 * current view. */
+		Scissor project_portal(const map::Portal& portal) const
+		{
+			return game::project_portal(portal.points, view, projection, viewport);
+		}
+
+		/* Find the rectangle through which every cell can be seen, by walking
+		 * the portals out of the cell the camera is in, narrowing the
+		 * rectangle down at every portal. A cell seen through more than one
+		 * portal gets the bounds of all of them. Works on the view that is
+		 * currently being drawn, whose camera is at the given position. */
+		void find_visible(glm::vec3 eye)
+		{
+			const auto& cells = world_map->cells();
+
+			auto camera = world_map->cell_at(eye);
+			if(!camera)
+			{
+				/* Outside of every cell, nothing limits what can be seen. */
+				std::fill(visible.begin(), visible.end(), viewport);
+				return;
+			}
+
+			std::fill(visible.begin(), visible.end(), Scissor { 0, -1, 0, -1 });
+			visible[*camera] = viewport;
+			pending.push_back(*camera);
+			queued[*camera] = 1;
+
+			while(!pending.empty())
+			{
+				uint32_t cell = pending.back();
+				pending.pop_back();
+				queued[cell] = 0;
+
+				for(auto index : cells[cell].portals)
+				{
+					const map::Portal& portal = world_map->portals()[index];
+					uint32_t next = portal.other(cell);
+
+					Scissor rect = project_portal(portal).intersection(visible[cell]);
+					if(rect.empty())
+						continue;
+
+					Scissor grown = visible[next].bounds(rect);
+					if(grown == visible[next])
+						continue;
+
+					visible[next] = grown;
+					if(!queued[next])
+					{
+						pending.push_back(next);
+						queued[next] = 1;
+					}
+				}
+			}
+		}
+
+		/* World space to camera space transformation matrix of a camera at
+		 * the given position, with the given rotation and scaling. */
+		static glm::mat4 look(glm::vec3 position, glm::vec3 rotation, glm::vec3 scaling)
+		{
+			glm::mat4 m = glm::mat4(1.0);
+			m = glm::rotate(m, rotation.x, glm::vec3(1.0, 0.0, 0.0));
+			m = glm::rotate(m, rotation.y, glm::vec3(0.0, 1.0, 0.0));
+			m = glm::rotate(m, rotation.z, glm::vec3(0.0, 0.0, 1.0));
+			m = glm::scale(m, glm::vec3(
+				 1.0 / scaling.x,
+				-1.0 / scaling.y,
+				 1.0 / scaling.z));
+
+			return glm::translate(m, -position);
+		}
+
+		/* Matrix stretching the given window of normalized device space, as
+		 * its left, right, bottom and top, over the whole of it. */
+		static glm::mat4 crop(glm::vec4 window)
+		{
+			float sx = (window.y - window.x) / 2.0f;
+			float sy = (window.w - window.z) / 2.0f;
+			float cx = (window.y + window.x) / 2.0f;
+			float cy = (window.w + window.z) / 2.0f;
+
+			/* Applied in clip space, so the offsets scale with W. */
+			glm::mat4 m = glm::mat4(1.0);
+			m[0][0] = 1.0f / sx;
+			m[1][1] = 1.0f / sy;
+			m[3][0] = -cx / sx;
+			m[3][1] = -cy / sy;
+
+			return m;
+		}
+
+		/* Submit everything the given view can see to the world raster,
+		 * without flushing it. */
+		void draw_view(const ViewState& state)
+		{
+			projection = state.projection;
+			view       = state.view;
+			viewport   = state.viewport;
+			placement  = placement_of(viewport);
+
+			if(world_map->cells().empty())
+			{
+				for(uint32_t i = 0; i < world_map->models().size(); ++i)
+					draw_model(i, viewport);
+				return;
+			}
+
+			/* Only submit the models in cells that can be seen, clipped to
+			 * the portals they're seen through. */
+			find_visible(state.eye);
+			for(auto i : loose)
+				draw_model(i, viewport);
+			for(uint32_t i = 0; i < world_map->cells().size(); ++i)
+			{
+				if(visible[i].empty())
+					continue;
+				for(auto j : world_map->cells()[i].models)
+					draw_model(j, visible[i]);
+			}
+		}
+
+		/* Draw the model slice with the given index, limited to the given
+		 * scissor rectangle. The slice gets set up in the background, along
+		 * with every other one, until the frame is flushed. */
+		void draw_model(uint32_t index, Scissor rect)
+		{
+			const auto& m = world_map->models()[index];
+			draws[draw_count] = DrawState
+			{
+				.model_view = m.is_static() ? view : view * m.transformation(),
+				.projection = placement * projection,
+				.clip       = rect
+			};
+
+			world.draw(draw_count++);
+			m.dispatch(world);
+		}
+
+		/* State of the slice the triangle being set up by the calling thread
+		 * belongs to. */
+		const DrawState& current_draw() const
+		{
+			return draws[world.local_draw()];
+		}
+
+		/* Side of the square tiles the screen is split into for tracing. */
+		static constexpr uint32_t TRACE_TILE = 16;
+
+		/* Width of the block of pixels whose rays are traced together, the
+		 * height of which makes up the rest of a packet. */
+		static constexpr uint32_t PACKET_WIDTH = 4;
+		static constexpr uint32_t PACKET_HEIGHT = map::PACKET / PACKET_WIDTH;
+
+		/* Direction light comes from for shadows, and how much of it is left
+		 * in the shade. */
+		static inline const glm::vec3 SUN = glm::normalize(glm::vec3(0.3, 1.0, 0.2));
+		static constexpr float SHADE = 0.5;
+
+		/* Number of tiles the given rectangle is split into for tracing,
+		 * across and down. */
+		static std::tuple<uint32_t, uint32_t> trace_tiles_of(const Scissor& rect)
+		{
+			uint32_t width  = (uint32_t) (rect.right  - rect.left + 1);
+			uint32_t height = (uint32_t) (rect.bottom - rect.top  + 1);
+
+			return std::make_tuple(
+				(width  + TRACE_TILE - 1) / TRACE_TILE,
+				(height + TRACE_TILE - 1) / TRACE_TILE);
+		}
+
+		/* Trace all of the views on all of the active workers, as an
+		 * alternative to rasterizing them, into the same screen and depth
+		 * buffers. The tiles of every view go into one pile, such that no
+		 * worker waits for another one between views. */
+		void trace_world()
+		{
+			uint32_t tiles = 0;
+			for(uint32_t i = 0; i < _views.size(); ++i)
+			{
+				_states[i].first_tile = tiles;
+				if(_states[i].viewport.empty())
+					continue;
+
+				auto [columns, rows] = trace_tiles_of(_states[i].viewport);
+				tiles += columns * rows;
+			}
+			if(tiles == 0)
+				return;
+
+			next_tile.store(0, std::memory_order_relaxed);
+
+			thread_pool& pool = world.workers();
+			uint32_t workers = pool.active();
+			tracing.add(workers);
+			for(uint32_t i = 0; i < workers; ++i)
+				pool.submit_job_for(i, make_job(trace_job));
+			tracing.wait();
+		}
+
+		/* Trace tiles until there are none left. */
+		void trace_tiles()
+		{
+			uint32_t current = 0;
+			while(true)
+			{
+				uint32_t tile = next_tile.fetch_add(1, std::memory_order_relaxed);
+
+				/* Tiles are handed out in order, so the view a tile belongs
+				 * to never comes before the one of the last tile. */
+				while(current + 1 < _views.size() && tile >= _states[current + 1].first_tile)
+					current++;
+
+				const ViewState& state = _states[current];
+				if(state.viewport.empty())
+					return;
+
+				auto [columns, rows] = trace_tiles_of(state.viewport);
+				uint32_t local = tile - state.first_tile;
+				if(local >= columns * rows)
+					return;
+
+				uint32_t x0 = state.viewport.left + (local % columns) * TRACE_TILE;
+				uint32_t y0 = state.viewport.top  + (local / columns) * TRACE_TILE;
+				uint32_t x1 = std::min(x0 + TRACE_TILE, (uint32_t) state.viewport.right  + 1);
+				uint32_t y1 = std::min(y0 + TRACE_TILE, (uint32_t) state.viewport.bottom + 1);
+
+				for(uint32_t y = y0; y < y1; y += PACKET_HEIGHT)
+					for(uint32_t x = x0; x < x1; x += PACKET_WIDTH)
+						trace_packet(state, x, y, x1, y1);
+			}
+		}
+
+		/* Trace the block of pixels with the given top-left corner through
+		 * the given view, leaving out the pixels past the given bounds. */
+		void trace_packet(const ViewState& state, uint32_t x, uint32_t y, uint32_t right, uint32_t bottom)
+		{
+			const map::Bvh& bvh = world_map->bvh();
+			const float inf = std::numeric_limits<float>::infinity();
+
+			/* Primary rays go through the centers of the pixels, and are
+			 * scaled such that they advance one unit in depth per unit,
+			 * which makes the distance of a hit its depth. Points in front
+			 * of the plane the raster clips against are left out. */
+			map::RayPacket rays;
+			for(uint32_t i = 0; i < map::PACKET; ++i)
+			{
+				uint32_t px = x + i % PACKET_WIDTH;
+				uint32_t py = y + i / PACKET_WIDTH;
+				if(px >= right || py >= bottom)
+				{
+					rays.disable(i);
+					continue;
+				}
+
+				float width  = (float) (state.viewport.right  - state.viewport.left + 1);
+				float height = (float) (state.viewport.bottom - state.viewport.top  + 1);
+				float nx = 2.0f * ((float) (px - state.viewport.left) + 0.5f) / width - 1.0f;
+				float ny = 1.0f - 2.0f * ((float) (py - state.viewport.top) + 0.5f) / height;
+
+				/* Any point the pixel projects from lies on its ray, and the
+				 * frustum may be off-center, so go back through the inverse
+				 * of the projection, rather than the field of view. */
+				glm::vec4 point = state.unproject * glm::vec4(nx, ny, 0.0, 1.0);
+				glm::vec3 direction = glm::vec3(point) / point.z;
+
+				rays.set(i, state.eye, state.camera * direction, 1.0f, inf);
+			}
+			bvh.intersect(rays);
+
+			/* Shadow rays leave from the hits towards the sun, starting a
+			 * little off of the surface, so as to not hit it again. */
+			map::RayPacket shadows;
+			if(_controller.shadows())
+			{
+				for(uint32_t i = 0; i < map::PACKET; ++i)
+				{
+					if(rays.hit[i] == map::RayPacket::NO_HIT)
+					{
+						shadows.disable(i);
+						continue;
+					}
+					glm::vec3 origin = glm::vec3(rays.ox[i], rays.oy[i], rays.oz[i])
+						+ rays.far[i] * glm::vec3(rays.dx[i], rays.dy[i], rays.dz[i]);
+					shadows.set(i, origin, SUN, 1e-3f * rays.far[i], inf);
+				}
+				bvh.occluded(shadows);
+			}
+
+			for(uint32_t i = 0; i < map::PACKET; ++i)
+			{
+				if(rays.hit[i] == map::RayPacket::NO_HIT)
+					continue;
+
+				uint32_t px = x + i % PACKET_WIDTH;
+				uint32_t py = y + i / PACKET_WIDTH;
+
+				map::Point p = bvh.surface(rays.hit[i], rays.u[i], rays.v[i]);
+				p.position.z = rays.far[i];
+				if(_controller.shadows() && shadows.hit[i] != map::RayPacket::NO_HIT)
+					p.color = p.color * SHADE;
+
+				depth.at(px, py) = p.position.z;
+				shade(px, py, p);
+			}
+		}
+
+		/* Write the color of the given point to the screen. */
+		void shade(uint32_t x, uint32_t y, const map::Point& p)
+		{
+			glm::vec3 color = p.color;
+			screen.at(x, y).red   = color.x / std::max(p.position.z / 10.0f, 1.0f);
+			screen.at(x, y).green = color.y / std::max(p.position.z / 10.0f, 1.0f);
+			screen.at(x, y).blue  = color.z / std::max(p.position.z / 10.0f, 1.0f);
+			screen.at(x, y).alpha = 255;
+		}
+		/* Draw the statistics of the last frame over the top-left corner of
+		 * the screen. Formats into fixed buffers, so it doesn't allocate. */
+		void draw_overlay()
+		{
+			const gfx::RasterStats& stats = world.stats();
+
+			Pixel yellow;
+			yellow.red   = 0xff;
+			yellow.green = 0xff;
+			yellow.blue  = 0x00;
+			yellow.alpha = 0xff;
+
+			double pixels   = (double) screen.width() * (double) screen.height();
+			double overdraw = pixels > 0 ? (double) stats.fragments / pixels : 0.0;
+			double culled   = stats.submitted > 0
+				? 100.0 * (double) stats.culled / (double) stats.submitted
+				: 0.0;
+
+			char lines[5][96];
+			std::snprintf(lines[0], sizeof(lines[0]),
+				"TRIS %llu CLIP %llu CULL %llu RAST %llu",
+				(unsigned long long) stats.submitted,
+				(unsigned long long) stats.clipped,
+				(unsigned long long) stats.culled,
+				(unsigned long long) stats.rasterized);
+			std::snprintf(lines[1], sizeof(lines[1]),
+				"FRAGS %llu WRITTEN %llu REJECTED %llu",
+				(unsigned long long) stats.fragments,
+				(unsigned long long) stats.written,
+				(unsigned long long) stats.rejected);
+			std::snprintf(lines[2], sizeof(lines[2]),
+				"OVERDRAW %.2f", overdraw);
+			std::snprintf(lines[3], sizeof(lines[3]),
+				"CULLED %.1f%%", culled);
+			std::snprintf(lines[4], sizeof(lines[4]),
+				"THREADS %u/%u BUSY %.0f%%",
+				(unsigned) world.active_threads(),
+				(unsigned) world.threads(),
+				100.0 * world.utilization());
+
+			for(uint32_t i = 0; i < 5; ++i)
+				gfx::draw_text(screen, 4, 4 + i * 12, lines[i], yellow, 2);
+		}
 	public:
+		/* Time every frame is allowed to take. */
+		static constexpr std::chrono::nanoseconds FRAME_BUDGET =
+			std::chrono::nanoseconds(1000000000 / 60);
+
+		/* Time between two writes of the log. */
+		static constexpr std::chrono::nanoseconds LOG_INTERVAL =
+			std::chrono::milliseconds(100);
+
+		/* Creates a game that draws with as many threads as the machine has,
+		 * but keeps only as many of them busy as it takes to stay within the
+		 * frame budget. */
 		Game(uint32_t width, uint32_t height)
-			: screen(width, height), depth(width, height), lock(width, height)
+			: Game(width, height, 1, thread_pool::default_concurrency())
+		{ }
+
+		/* Creates a game that draws with at least `min_threads` and at most
+		 * `max_threads` threads. Setting both to the same value keeps the
+		 * number of threads fixed. */
+		Game(uint32_t width, uint32_t height, uint32_t min_threads, uint32_t max_threads)
+			/* On machines with more than one NUMA node, keep every band of
+			 * the frame buffers on the node whose workers draw it. They're
+			 * placed before anything gets written to them, as constructing
+			 * pixels and mutexes already touches their pages. */
+			: topology(numa_topology::detect()),
+			  screen(width, height, topology),
+			  depth(width, height, topology),
+			  lock(width, height, topology),
+			  world(min_threads, max_threads)
 		{ 
-			/* Load the map. */
-			std::ifstream map;
-			map.open("assets/map0.map", std::ios_base::in | std::ios_base::binary);
-			if(!map)
-				throw std::runtime_error("could not open assets/map0.map");
+			/* Logging never allocates, so the threads that log get their rings
+			 * now, rather than in the middle of a frame. */
+			log_register_thread();
+			log_register_pool(world.workers());
+
+			/* Messages get logged from the workers in the middle of frames,
+			 * so leave writing them out to a timer. It runs on the timer
+			 * thread, as formatting and writing out the messages on a worker
+			 * would hold up whatever part of the frame that worker has. */
+			log_timer = world.workers().schedule_every(LOG_INTERVAL, [](uint32_t)
+			{
+				log_drain(std::cerr);
+			}, true);
+
+			world.viewport(width, height);
+
+			/* Spread the workers over the nodes, matching the frame buffers. */
+			world.place(topology);
+
+			/* Load the map, or share it with the games already on it. */
+			world_map = map::MapCache::shared().load(
+				"assets/map0.map",
+				topology,
+				&world.workers());
+			viewport = fullscreen();
+			placement = placement_of(viewport);
+			setup_world();
 
-			world_map = map::Map::load(map);
+			/* Until told otherwise, frames are the view of the player. */
+			views({ View { .viewport = fullscreen() } });
+
+			/* Everything needed to walk the portals is allocated up front, as
+			 * iterations aren't supposed to allocate. */
+			const auto& cells = world_map->cells();
+			visible.resize(cells.size());
+			pending.reserve(cells.size());
+			queued.resize(cells.size(), 0);
+
+			std::vector<uint8_t> celled(world_map->models().size(), 0);
+			for(const auto& cell : cells)
+				for(auto i : cell.models)
+					celled[i] = 1;
+			for(uint32_t i = 0; i < celled.size(); ++i)
+				if(!celled[i])
+					loose.push_back(i);
+
+			draws_per_view = (uint32_t) (cells.empty() ? world_map->models().size() : loose.size());
+			for(const auto& cell : cells)
+				draws_per_view += (uint32_t) cell.models.size();
 
 
-			projection = glm::perspective(glm::radians(45.0), 4.0 / 3.0, 2.0, 100.0);
 			player.position = glm::vec3(0.0);
 			player.velocity = glm::vec3(0.0);
 			player.rotation = glm::vec3(0.0);
 			player.scaling  = glm::vec3(1.0);
 		}
 
+		~Game()
+		{
+			/* Write out whatever got logged since the last time the timer
+			 * went off. */
+			world.workers().cancel_timer(log_timer);
+			log_drain(std::cerr);
+		}
+
 		/* Reference to the controller interface for this game. */
 		const Controller& controller() const noexcept { return _controller; }
 		      Controller& controller()       noexcept { return _controller; }
 
-		/* Perform one iteration of the game loop. */
+		/* Number of frames after which the game is expected to have warmed up
+		 * and to not allocate any more memory during iterations. */
+		static constexpr uint64_t WARMUP_FRAMES = 8;
+
+		/* Perform one iteration of the game loop.
+		 *
+		 * Once warm, this function should not allocate. When allocation
+		 * tracking is compiled in and its assertion is enabled, allocating in
+		 * here, from any thread, aborts. */
 		void iterate(double delta)
 		{
+			alloc_forbid_scope no_alloc(frames++ >= WARMUP_FRAMES);
+
 			/* Update the position of the player. */
-			static double angle = 3.1415 / 2.0;
 			player.scaling = glm::vec3(1.0);
 
 			if(_controller.left())
@@ -207,192 +1181,144 @@ export namespace game
 			white.blue  = 0x11;
 			white.alpha = 0xff;
 
-			screen.clear(white);
-            /* (+1.0 / 0.0) yields +Infinity, such that n < depth == true for any n */
-			depth.clear(+1.0 / 0.0);
-
-			glm::mat4 view = glm::mat4(1.0);
-			view = glm::rotate(view, player.rotation.x, glm::vec3(1.0, 0.0, 0.0));
-			view = glm::rotate(view, player.rotation.y, glm::vec3(0.0, 1.0, 0.0));
-			view = glm::rotate(view, player.rotation.z, glm::vec3(0.0, 0.0, 1.0));
-			view = glm::scale(view, glm::vec3(
-				 1.0 / player.scaling.x,
-				-1.0 / player.scaling.y,
-				 1.0 / player.scaling.z));
-			view = glm::translate(view, -player.position);
-
-			for(auto& model : world_map.models())
+			if(_acquire)
+				screen = gfx::Plane<Pixel>(screen.width(), screen.height(), _acquire());
+
 			{
-				auto transform = model.transformation();
-				world.transform = [&](map::Point p)
-				{
-					glm::vec4 point = view * transform * p.position;
-					p.position = point;
+				perf_scope scope(perf_stage::clear);
 
-					return p;
-				};
-				world.tesselation = [&](
-					map::Point a, 
-					map::Point b, 
-					map::Point c, 
-					std::function<void(map::Point, map::Point, map::Point)> dispatch)
-				{
-					glm::vec3 q(0.0, 0.0, 1.0);
-					glm::vec3 n(0.0, 0.0, 1.0);
-					
-					auto ndot = [&](glm::vec3 p)
-					{
-						return glm::dot(n, p - q);
-					};
+				screen.clear(white);
+				/* (+1.0 / 0.0) yields +Infinity, such that n < depth == true for any n */
+				depth.clear(+1.0 / 0.0);
+			}
 
-					auto lncross = [&](glm::vec3 a, glm::vec3 b) -> std::optional<glm::vec3>
-					{
-						glm::vec3 v0 = a - q;
-						glm::vec3 v1 = b - q;
+			/* Work out the cameras of all of the views up front, as tracing
+			 * needs all of them at once. */
+			for(uint32_t i = 0; i < _views.size(); ++i)
+			{
+				const View& v = _views[i];
+				ViewState& state = _states[i];
 
-						float d0 = glm::dot(n, v0);
-						float d1 = glm::dot(n, v1);
+				state.viewport = v.viewport;
+				state.view = v.follow
+					? look(player.position, player.rotation, player.scaling)
+					: look(v.position, v.rotation, glm::vec3(1.0));
 
-						if(std::signbit(d0) == std::signbit(d1))
-							/* Line segment doesn't cross the plane. */
-							return {};
+				double width  = v.viewport.right  - v.viewport.left + 1;
+				double height = v.viewport.bottom - v.viewport.top  + 1;
+				double aspect = v.aspect > 0.0f ? v.aspect : width / std::max(height, 1.0);
+				state.projection = crop(v.window) * glm::perspective(
+					(double) v.fov, aspect, 2.0, 100.0);
 
-						float t = d0 / (d1 - d0);
-						return a + t * (b - a);
-					};
+				glm::mat4 inverse = glm::inverse(state.view);
+				state.eye       = glm::vec3(inverse[3]);
+				state.camera    = glm::mat3(inverse);
+				state.unproject = glm::inverse(state.projection);
+			}
 
-					auto lenrat = [](glm::vec3 a, glm::vec3 shrt, glm::vec3 lng)
-					{
-						float l = glm::length(lng  - a);
-						float s = glm::length(shrt - a);
+			/* All of the models in the map are static world geometry, which
+			 * never intersects itself, so it can be drawn with spans. */
+			world.visibility(_controller.spans()
+				? gfx::Visibility::Spans
+				: gfx::Visibility::Depth);
 
-						return s / l;
-					};
-					
-					uint32_t trigs = 0;
-					map::Point points[4];
+			if(_controller.trace())
+			{
+				/* The hierarchy already skips whatever rays can't reach, so
+				 * there's no need for the portals. */
+				trace_world();
+			}
+			else
+			{
+				/* Every view gets binned into the same raster, and the views
+				 * don't overlap, so a single flush draws all of them, with
+				 * all of their tiles spread over the pool together. */
+				draws = world.frame_allocate<DrawState>(_views.size() * draws_per_view);
+				draw_count = 0;
+				for(uint32_t i = 0; i < _views.size(); ++i)
+					if(!_states[i].viewport.empty())
+						draw_view(_states[i]);
 
-					auto p_add = [&](map::Point a)
-					{
-						if(trigs >= 4)
-						{
-							std::cerr << u8"more than three points in triangle crossing"_fb;
-							std::cerr << std::endl;
-							return;
-						}
-						points[trigs++] = a;
-					};
+				world.flush();
+			}
 
-					auto p_lncross_test = [&](map::Point a, map::Point b)
-					{
-						std::optional<glm::vec3> ocross = lncross(
-							a.position.xyz(), 
-							b.position.xyz());
-						if(!ocross) return;
-						
-						glm::vec3 cross = ocross.value();
-						float midf = lenrat(
-							a.position.xyz(),
-							cross,
-							b.position.xyz());
-
-						map::PointSlope slope(a, b);
-						map::Point mid = slope.at(midf);
-
-						/* Passed the test. */
-						p_add(mid);
-					};
-					
-					auto test = [&](map::Point p)
-					{
-						if(ndot(p.position.xyz()) >= -0.0) 
-						{
-							p_add(p);
-						}
-					};
-				
-					test(a);
-					p_lncross_test(a, b);
-					test(b);
-					p_lncross_test(b, c);
-					test(c);
-					p_lncross_test(c, a);
-
-					if(trigs == 3)
-					{
-						dispatch(points[0], points[1], points[2]);
-					}
-					else if(trigs == 4)
-					{
-						dispatch(points[0], points[1], points[2]);
-						dispatch(points[0], points[2], points[3]);
-					}
-					else if(trigs != 0)
-					{
-						std::cerr << u8"only valid trig values are 0, 3 and 4"_fb;
-						std::cerr << std::endl;
-					}
+			/* Park the workers this frame didn't need, or wake up the ones it
+			 * did, for the next one. */
+			world.adapt(FRAME_BUDGET);
 
-				};
-				world.project = [&](map::Point p)
-				{
-					float z = p.position.z;
-					p.position = this->projection * p.position;
-					p.position /= p.position.w;
-					p.position.z = z;
+			if(_controller.overlay())
+				draw_overlay();
 
-					return p;
-				};
-				world.screen = [&](map::Point p)
-				{
-					int32_t x = std::round((p.position.x + 1.0) * (double) screen.width()  / 2.0);
-					int32_t y = std::round((p.position.y + 1.0) * (double) screen.height() / 2.0);
-					y = (int32_t) screen.height() - y;
+			if(_publish)
+				_publish();
+		}
 
-					return std::make_tuple(x, y);
-				};
-				world.scissor = [&]()
-				{
-					/* Cut off-screen pixels. */
-					return std::make_tuple(
-						0, screen.width(),
-						0, screen.height());
-				};
-				world.slope = [&](map::Point a, map::Point b)
-				{
-					return map::PointSlope(a, b);
-				};
-				world.painter = [&](uint32_t x, uint32_t y, map::Point p)
-				{
-					auto sampler = gfx::Sampler<gfx::PixelRgba32, gfx::PixelRgba32Slope>(
-						world_map.textures().at(p.texture_index),
-						[](gfx::PixelRgba32 a, gfx::PixelRgba32 b) {
-							return gfx::PixelRgba32Slope(a, b);
-						});
+		/* Makes every frame from now on out of the given views, rather than
+		 * just the view of the player. All of the views get drawn together,
+		 * sharing the world geometry, the portals and the workers, as opposed
+		 * to drawing them one frame at a time. Views must not overlap, and
+		 * get cut down to the screen.
+		 *
+		 * This allocates, so it should be done before frames get drawn, not
+		 * in between every one of them. */
+		void views(std::vector<View> views)
+		{
+			for(auto& v : views)
+				v.viewport = v.viewport.intersection(fullscreen());
 
-					if(x < 0 || x >= screen.width()) return;
-					if(y < 0 || y >= screen.height()) return;
+			_views = std::move(views);
+			_states.resize(_views.size());
+		}
 
-					lock.at(x, y).lock();
-					if(depth.at(x, y) < p.position.z)
-					{
-						lock.at(x, y).unlock();
-						return;
-					}
-					depth.at(x, y) = p.position.z;
+		/* Views every frame is made of. */
+		const std::vector<View>& views() const
+		{
+			return _views;
+		}
 
-					glm::vec3 color = p.color;
-					screen.at(x, y).red   = color.x / std::max(p.position.z / 10.0f, 1.0f);
-					screen.at(x, y).green = color.y / std::max(p.position.z / 10.0f, 1.0f);
-					screen.at(x, y).blue  = color.z / std::max(p.position.z / 10.0f, 1.0f);
-					screen.at(x, y).alpha = 255;
+		/* Renders every frame from now on straight into the storage returned
+		 * by `acquire`, which must hold a whole frame, calling `publish` once
+		 * the frame is complete, rather than into the game's own screen
+		 * buffer. This is how frames get handed to other processes without
+		 * copying them. Passing empty functions goes back to the game's own
+		 * buffer.
+		 *
+		 * Neither function may allocate, if iterations are to stay free of
+		 * allocations. */
+		void output(std::function<Pixel*()> acquire, std::function<void()> publish)
+		{
+			_acquire = std::move(acquire);
+			_publish = std::move(publish);
 
-					lock.at(x, y).unlock();
-				};
+			if(!_acquire)
+				screen = gfx::Plane<Pixel>(screen.width(), screen.height(), topology);
+		}
 
-				auto mesh = model.mesh();
-				mesh.draw(world);
-			}
+		/* Starts capturing every frame rendered by the world rasterizer to
+		 * the given stream, or stops capturing, if it's null. Captures can
+		 * be replayed without the game by QuakeOatsReplay. */
+		void capture(std::ostream *out) noexcept
+		{
+			world.capture(out);
+		}
+
+		/* Counters of the last frame rendered by the world rasterizer. */
+		const gfx::RasterStats& render_stats() const
+		{
+			return world.stats();
+		}
+
+		/* Number of threads the world rasterizer is currently drawing with. */
+		uint32_t render_threads() const
+		{
+			return world.active_threads();
+		}
+
+		/* Pool the game renders on, for work on finished frames that should
+		 * share its workers. */
+		thread_pool& workers()
+		{
+			return world.workers();
 		}
 
 		constexpr bool exit() const
@@ -410,4 +1336,91 @@ export namespace game
 			return this->screen;
 		}
 	};
+
+	/* Renders stills of any size, such as for print or for reviewing a map,
+	 * without ever holding more than a tile of the picture in the frame
+	 * buffers, along with a band of finished rows.
+	 *
+	 * The picture is split into bands of rows as tall as a tile, and every
+	 * band into tiles, each of which the game draws as a view with an
+	 * off-center frustum, spread over all of its workers like any other
+	 * frame. Every band gets written out as part of a binary PPM as soon as
+	 * it's done. */
+	class Still
+	{
+	protected:
+		Game _game;
+
+		/* Finished rows of the current band, as packed RGB. */
+		std::vector<uint8_t> _band;
+	public:
+		/* Creates a renderer drawing tiles of the given size with the given
+		 * number of threads. */
+		Still(uint32_t tile_width, uint32_t tile_height, uint32_t threads)
+			: _game(tile_width, tile_height, threads, threads)
+		{ }
+
+		/* Controller of the game drawing the tiles, for picking how they
+		 * get drawn. */
+		Controller& controller() noexcept { return _game.controller(); }
+
+		/* Renders a picture of the given size, as seen by the given camera,
+		 * whose viewport and window are ignored, to the given stream. Returns
+		 * whether all of it could be written. */
+		bool render(std::ostream& out, uint32_t width, uint32_t height, View camera)
+		{
+			const gfx::Plane<Pixel>& screen = _game.get_screen();
+			uint32_t tile_width  = screen.width();
+			uint32_t tile_height = screen.height();
+			_band.resize((size_t) width * tile_height * 3);
+
+			out << "P6\n" << width << " " << height << "\n255\n";
+
+			camera.follow = false;
+			camera.aspect = (float) width / (float) height;
+			std::vector<View> views(1, camera);
+
+			for(uint32_t y0 = 0; y0 < height; y0 += tile_height)
+			{
+				uint32_t y1 = std::min(y0 + tile_height, height);
+				for(uint32_t x0 = 0; x0 < width; x0 += tile_width)
+				{
+					uint32_t x1 = std::min(x0 + tile_width, width);
+
+					View& view = views[0];
+					view.viewport = Scissor
+					{
+						.left   = 0,
+						.right  = (int32_t) (x1 - x0) - 1,
+						.top    = 0,
+						.bottom = (int32_t) (y1 - y0) - 1
+					};
+					view.window = glm::vec4(
+						2.0 * x0 / width  - 1.0,
+						2.0 * x1 / width  - 1.0,
+						1.0 - 2.0 * y1 / height,
+						1.0 - 2.0 * y0 / height);
+
+					_game.views(views);
+					_game.iterate(0.0);
+
+					for(uint32_t y = y0; y < y1; ++y)
+						for(uint32_t x = x0; x < x1; ++x)
+						{
+							const Pixel& p = screen.at(x - x0, y - y0);
+							uint8_t *rgb = &_band[((size_t) (y - y0) * width + x) * 3];
+							rgb[0] = p.red;
+							rgb[1] = p.green;
+							rgb[2] = p.blue;
+						}
+				}
+
+				out.write((const char*) _band.data(), (std::streamsize) (y1 - y0) * width * 3);
+				if(!out)
+					return false;
+			}
+
+			return true;
+		}
+	};
 }
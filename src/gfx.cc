@@ -2,6 +2,9 @@
  * renderer with a multi-stage pipeline and other graphics utilities. */
 module;
 #include "thread_utils.hpp"	/* Thanks Natan. */
+#include "perf_utils.hpp"	/* For per-stage counters. */
+#include "numa_utils.hpp"	/* For memory and tile placement. */
+#include "log_utils.hpp"	/* For warnings from the pipeline. */
 
 export module gfx;
 
@@ -10,8 +13,15 @@ import <sstream>;	/* AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA.	*/
 import <cstdint>;	/* For standard integer types.		*/
 import <stdexcept>;	/* For standard exception types.	*/
 import <concepts>;	/* For standard concepts.			*/
-import <iostream>;	/* For warning messages.			*/
+import <iostream>;	/* For frame capture streams.		*/
 import <cmath>;		/* For floor() and ceil().			*/
+import <vector>;	/* For bins and tile lists.			*/
+import <chrono>;	/* For measuring tile costs.		*/
+import <algorithm>;	/* For sorting tiles.				*/
+import <bit>;		/* For scanning coverage masks.		*/
+import <limits>;	/* For strip restart indices.		*/
+import <memory>;	/* For constructing plane storage.	*/
+import <new>;		/* For aligning plane storage.		*/
 import str;			/* Haha UTF-8 go brr.				*/
 
 export namespace gfx
@@ -103,6 +113,58 @@ export namespace gfx
 				throw std::range_error(what.str());
 			}
 		}
+
+		/* Allocates uninitialized storage for the given number of data
+		 * points. Storage is aligned to pages, such that it can be placed on
+		 * the memory of the NUMA nodes without dragging any other data along
+		 * with it. */
+		static T* _reserve(size_t count)
+		{
+			size_t bytes = std::max<size_t>(count * sizeof(T), 1);
+			return static_cast<T*>(::operator new(bytes, std::align_val_t(numa_page_size())));
+		}
+
+		/* Allocates storage for the given number of data points, and default
+		 * constructs them. Types that write to their memory when constructed,
+		 * such as pixels and mutexes, touch all of it right away, and with
+		 * that get it placed on the node of the calling thread. */
+		static T* _allocate(size_t count)
+		{
+			T *data = _reserve(count);
+			std::uninitialized_default_construct_n(data, count);
+
+			return data;
+		}
+
+		/* Binds every band of rows of the plane to the memory of its node.
+		 * See `place()`. */
+		void _bind(const numa_topology& topology)
+		{
+			for(uint32_t node = 0; node < topology.nodes(); ++node)
+			{
+				/* First row of the band, rounded up, and the first row of the
+				 * next one. */
+				auto first = [&](uint32_t n)
+				{
+					return (uint32_t) (((uint64_t) n * _height + topology.nodes() - 1) / topology.nodes());
+				};
+				uint32_t top    = first(node);
+				uint32_t bottom = first(node + 1);
+
+				numa_bind(
+					this->_data + (size_t) top * _width,
+					(size_t) (bottom - top) * _width * sizeof(T),
+					topology,
+					node);
+			}
+		}
+
+		/* Releases storage obtained from `_allocate()`. */
+		static void _release(T *data, size_t count)
+		{
+			std::destroy_n(data, count);
+			::operator delete(data, std::align_val_t(numa_page_size()));
+		}
 	public:
 		/* Creates a new plane with the given dimensions.
 		 * 
@@ -117,15 +179,38 @@ export namespace gfx
 		Plane(uint32_t width, uint32_t height)
 			: _width(width), _height(height)
 		{
-			this->_data = new T[width * height];
+			this->_data = _allocate((size_t) width * height);
 			this->_owns = true;
 		}
 
+		/* Creates a new plane with the given dimensions, with its rows placed
+		 * on the memory of the NUMA nodes just like `place()` does, but before
+		 * its data points get constructed. This way every page is first
+		 * touched on the node it belongs to, rather than having to be moved
+		 * there afterwards. */
+		Plane(uint32_t width, uint32_t height, const numa_topology& topology)
+			: _width(width), _height(height)
+		{
+			size_t count = (size_t) width * height;
+			this->_data = _reserve(count);
+			this->_owns = true;
+
+			_bind(topology);
+			std::uninitialized_default_construct_n(this->_data, count);
+		}
+
+		/* Creates a plane over existing storage, of at least `width * height`
+		 * data points, laid out in row-major with no stride. The plane doesn't
+		 * take ownership of the storage, which must outlive it. */
+		Plane(uint32_t width, uint32_t height, T *data)
+			: _width(width), _height(height), _data(data), _owns(false)
+		{ }
+
 		~Plane()
 		{
 			if(_owns) 
 				/* We own the buffer. */
-				delete[] this->_data;
+				_release(this->_data, (size_t) _width * _height);
 		}	
 
 		/* Copy constructor. */
@@ -133,7 +218,7 @@ export namespace gfx
 		{
 			this->_width  = source._width;
 			this->_height = source._height;
-			this->_data   = new T[source._width * source._height];
+			this->_data   = _allocate((size_t) source._width * source._height);
 			this->_owns   = true;
 
 			std::memcpy(
@@ -148,8 +233,25 @@ export namespace gfx
 			this->_width  = source._width;
 			this->_height = source._height;
 			this->_data   = source._data;
-			this->_owns   = true;
+			this->_owns   = source._owns;
+			source._owns  = false;
+		}
+
+		/* Move assignment operator. Releases the current storage, if owned. */
+		Plane& operator =(Plane&& source)
+		{
+			if(this == &source)
+				return *this;
+			if(_owns)
+				_release(this->_data, (size_t) _width * _height);
+
+			this->_width  = source._width;
+			this->_height = source._height;
+			this->_data   = source._data;
+			this->_owns   = source._owns;
 			source._owns  = false;
+
+			return *this;
 		}
 
 		/* Acquire a reference to a data point in the plane at the given x and y
@@ -212,6 +314,27 @@ export namespace gfx
 					this->_data[i * this->_width + j] = clear;
 		}
 
+		/* Places the rows of the plane on the memory of the NUMA nodes, in one
+		 * band of rows per node, matching `numa_topology::node_of_row()`. This
+		 * suits planes that get written by the raster, as it hands the tiles
+		 * in every band to the workers of its node.
+		 *
+		 * Pages that have already been touched, as the ones of any plane with
+		 * data points that write to their memory when constructed, have to be
+		 * moved over to their node, so prefer creating planes that are going
+		 * to be placed with a topology instead. */
+		void place(const numa_topology& topology)
+		{
+			_bind(topology);
+		}
+
+		/* Spreads the plane evenly over the memory of the NUMA nodes. This
+		 * suits planes that get read from everywhere, such as textures. */
+		void interleave(const numa_topology& topology)
+		{
+			numa_interleave(this->_data, (size_t) _width * _height * sizeof(T), topology);
+		}
+
 		/* Gets the width of this plane. */
 		uint32_t width() const
 		{
@@ -237,6 +360,85 @@ export namespace gfx
 		}
 	};
 
+	/* Returns the 3x5 bitmap glyph for the given character, in row-major, with
+	 * the most significant of the 15 bits being the top-left pixel. Characters
+	 * with no glyph are blank. Letters are always upper case. */
+	constexpr uint16_t glyph(char c)
+	{
+		if(c >= 'a' && c <= 'z')
+			c = c - 'a' + 'A';
+
+		switch(c)
+		{
+		case '0': return 0b111'101'101'101'111;
+		case '1': return 0b010'110'010'010'111;
+		case '2': return 0b111'001'111'100'111;
+		case '3': return 0b111'001'111'001'111;
+		case '4': return 0b101'101'111'001'001;
+		case '5': return 0b111'100'111'001'111;
+		case '6': return 0b111'100'111'101'111;
+		case '7': return 0b111'001'001'001'001;
+		case '8': return 0b111'101'111'101'111;
+		case '9': return 0b111'101'111'001'111;
+		case 'A': return 0b010'101'111'101'101;
+		case 'B': return 0b110'101'110'101'110;
+		case 'C': return 0b011'100'100'100'011;
+		case 'D': return 0b110'101'101'101'110;
+		case 'E': return 0b111'100'110'100'111;
+		case 'F': return 0b111'100'110'100'100;
+		case 'G': return 0b011'100'101'101'011;
+		case 'H': return 0b101'101'111'101'101;
+		case 'I': return 0b111'010'010'010'111;
+		case 'J': return 0b001'001'001'101'010;
+		case 'K': return 0b101'101'110'101'101;
+		case 'L': return 0b100'100'100'100'111;
+		case 'M': return 0b101'111'111'101'101;
+		case 'N': return 0b110'101'101'101'101;
+		case 'O': return 0b010'101'101'101'010;
+		case 'P': return 0b110'101'110'100'100;
+		case 'Q': return 0b010'101'101'110'011;
+		case 'R': return 0b110'101'110'101'101;
+		case 'S': return 0b011'100'010'001'110;
+		case 'T': return 0b111'010'010'010'010;
+		case 'U': return 0b101'101'101'101'111;
+		case 'V': return 0b101'101'101'101'010;
+		case 'W': return 0b101'101'111'111'101;
+		case 'X': return 0b101'101'010'101'101;
+		case 'Y': return 0b101'101'010'010'010;
+		case 'Z': return 0b111'001'010'100'111;
+		case '.': return 0b000'000'000'000'010;
+		case ':': return 0b000'010'000'010'000;
+		case '%': return 0b101'001'010'100'101;
+		case '/': return 0b001'001'010'100'100;
+		case '-': return 0b000'000'111'000'000;
+		default:  return 0;
+		}
+	}
+
+	/* Draws a line of text into the given plane, with its top-left corner at
+	 * the given coordinates, using the built-in 3x5 font. Every pixel of the
+	 * font gets drawn as a square of the given scale. Whatever falls outside of
+	 * the plane is cut off. */
+	template<typename T>
+	void draw_text(Plane<T>& plane, uint32_t x, uint32_t y, const char *text, T color, uint32_t scale = 1)
+	{
+		for(; *text; ++text, x += 4 * scale)
+		{
+			uint16_t bits = glyph(*text);
+			for(uint32_t i = 0; i < 5 * scale; ++i)
+				for(uint32_t j = 0; j < 3 * scale; ++j)
+				{
+					uint32_t bit = 14 - ((i / scale) * 3 + (j / scale));
+					if(!(bits & (1 << bit)))
+						continue;
+					if(x + j >= plane.width() || y + i >= plane.height())
+						continue;
+
+					plane.at_unckecked(x + j, y + i) = color;
+				}
+		}
+	}
+
 	template<typename T, typename P>
 	concept Slope = requires(T slope, double dPos, float fPos)
 	{
@@ -327,6 +529,438 @@ export namespace gfx
 		T at(float x, float y) const { return at((double) x, (double) y); }
 	};
 
+	/* Linear allocator for transient data.
+	 *
+	 * Allocations are served by bumping a pointer into a chunk of memory, and
+	 * are never freed individually. Instead, the whole arena gets reset at once
+	 * when the data in it is no longer needed, such as at the end of a frame.
+	 *
+	 * When an arena runs out of space in its chunk, a new, larger chunk gets
+	 * allocated from the heap. At the next reset, all of the chunks are fused
+	 * into a single one big enough to hold everything that was allocated, such
+	 * that, once the arena has seen its high-water mark, it stops touching the
+	 * heap altogether. */
+	class Arena
+	{
+	protected:
+		/* A block of memory allocations are served from. */
+		struct Chunk
+		{
+			std::unique_ptr<std::byte[]> data;
+			size_t size;
+		};
+
+		/* All of the chunks in this arena. Allocations are only ever served
+		 * from the last one. */
+		std::vector<Chunk> _chunks;
+
+		/* Offset of the first free byte in the last chunk. */
+		size_t _offset;
+
+		/* Prevent copying, as containers hold pointers to arenas. */
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+	protected:
+		/* Add a new chunk that is at least the given size. */
+		void _grow(size_t size)
+		{
+			size_t last = _chunks.empty() ? 0 : _chunks.back().size;
+			size = std::max(size, last * 2);
+
+			_chunks.push_back({ std::make_unique<std::byte[]>(size), size });
+			_offset = 0;
+		}
+	public:
+		/* Create a new arena with a first chunk of the given size, in bytes. */
+		Arena(size_t capacity = 64 * 1024)
+			: _offset(0)
+		{
+			_grow(capacity);
+		}
+
+		/* Allocate a block of memory with the given size and alignment. */
+		void* allocate(size_t size, size_t align)
+		{
+			/* Chunks only have the alignment of new, so it's the address that
+			 * gets aligned, rather than the offset into the chunk, as types
+			 * such as RasterStats ask for more than that. */
+			auto fit = [&]() -> std::byte*
+			{
+				std::byte *base = _chunks.back().data.get();
+				uintptr_t start = (uintptr_t) (base + _offset);
+				size_t offset = _offset + (((start + align - 1) & ~(uintptr_t) (align - 1)) - start);
+				if(offset + size > _chunks.back().size)
+					return nullptr;
+
+				_offset = offset + size;
+				return base + offset;
+			};
+
+			std::byte *block = fit();
+			if(!block)
+			{
+				/* Enough for the block wherever the new chunk starts. */
+				_grow(size + align);
+				block = fit();
+			}
+			return block;
+		}
+
+		/* Allocate uninitialized storage for the given number of objects. */
+		template<typename T>
+		T* allocate(size_t count)
+		{
+			return static_cast<T*>(this->allocate(count * sizeof(T), alignof(T)));
+		}
+
+		/* Allocate and construct an object in the arena. The destructor of
+		 * this object is never going to be called. */
+		template<typename T, typename... A>
+		T* make(A&&... args)
+		{
+			return new (this->allocate<T>(1)) T(std::forward<A>(args)...);
+		}
+
+		/* Invalidates all the allocations in the arena at once, fusing its
+		 * chunks together if it had to grow since the last reset. */
+		void reset()
+		{
+			if(_chunks.size() > 1)
+			{
+				size_t size = 0;
+				for(const auto& chunk : _chunks)
+					size += chunk.size;
+
+				_chunks.clear();
+				_grow(size);
+			}
+			_offset = 0;
+		}
+
+		/* Total number of bytes this arena can hold without growing. */
+		size_t capacity() const
+		{
+			size_t size = 0;
+			for(const auto& chunk : _chunks)
+				size += chunk.size;
+
+			return size;
+		}
+	};
+
+	/* Standard allocator adaptor for the arena, which lets containers have
+	 * their storage in it. Deallocation is a no-op, so containers using this
+	 * must never outlive a reset of their arena. */
+	template<typename T>
+	class ArenaAllocator
+	{
+	public:
+		using value_type = T;
+		using propagate_on_container_move_assignment = std::true_type;
+
+		/* The arena we allocate from. */
+		Arena *arena;
+
+		ArenaAllocator(Arena& arena)
+			: arena(&arena)
+		{ }
+
+		template<typename U>
+		ArenaAllocator(const ArenaAllocator<U>& other)
+			: arena(other.arena)
+		{ }
+
+		T* allocate(size_t count)
+		{
+			return arena->allocate<T>(count);
+		}
+
+		void deallocate(T*, size_t)
+		{ }
+
+		template<typename U>
+		bool operator ==(const ArenaAllocator<U>& other) const
+		{
+			return arena == other.arena;
+		}
+
+		template<typename U>
+		bool operator !=(const ArenaAllocator<U>& other) const
+		{
+			return arena != other.arena;
+		}
+	};
+
+	/* A vector whose storage lives in an arena. */
+	template<typename T>
+	using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+	/* Cost-aware tile scheduler.
+	 *
+	 * The screen is divided into a grid of fixed size cells, each of which has
+	 * the time it took to rasterize recorded every frame. Those timings are
+	 * then used to partition the grid into the tiles that will be handed out
+	 * to the workers in the next frame, such that expensive regions of the
+	 * screen get split into many small tiles and cheap ones get merged into
+	 * few large ones.
+	 *
+	 * Tiles are handed out largest-first, which keeps the tail of the frame
+	 * short, as the frame time is set by the slowest worker, not the average.
+	 */
+	class TileScheduler
+	{
+	public:
+		/* A rectangular group of cells that gets rasterized as a single task.
+		 * Bounds are given in cells and are in the [left, right) x [top, bottom)
+		 * range. The cost is the predicted cost of the tile, in nanoseconds. */
+		struct Tile
+		{
+			uint32_t left;
+			uint32_t right;
+			uint32_t top;
+			uint32_t bottom;
+			uint64_t cost;
+		};
+
+		/* Number of tiles we'd like every worker to get, in average. Having
+		 * more than one gives the largest-first ordering some room to even out
+		 * the load between the workers. */
+		static constexpr uint32_t TILES_PER_WORKER = 4;
+	protected:
+		/* Length of the side of a cell, in pixels. */
+		uint32_t _cell;
+
+		/* Extent of the grid, in cells. */
+		uint32_t _columns, _rows;
+
+		/* Cost of every cell in the last frame, in nanoseconds. */
+		std::vector<uint64_t> _costs;
+
+		/* Summed area table of the costs, with an extra row and column of
+		 * zeroes at the top and at the left. */
+		std::vector<uint64_t> _sums;
+
+		/* Tiles for the next frame, sorted by decreasing cost. */
+		std::vector<Tile> _tiles;
+	protected:
+		/* Total cost of the cells in the given region. */
+		uint64_t _cost(uint32_t left, uint32_t right, uint32_t top, uint32_t bottom) const
+		{
+			auto at = [&](uint32_t x, uint32_t y)
+			{
+				return _sums[y * (_columns + 1) + x];
+			};
+
+			return at(right, bottom) - at(left, bottom) - at(right, top) + at(left, top);
+		}
+
+		/* Recursively bisect the given region until its cost is under the
+		 * target cost or it can't be split any further. */
+		void _split(uint32_t left, uint32_t right, uint32_t top, uint32_t bottom, uint64_t target)
+		{
+			uint64_t cost = _cost(left, right, top, bottom);
+			if(cost <= target || (right - left == 1 && bottom - top == 1))
+			{
+				_tiles.push_back({ left, right, top, bottom, cost });
+				return;
+			}
+
+			/* Split across the longest axis, at the point that best balances
+			 * the cost between the two halves. */
+			bool vertical = right - left >= bottom - top;
+			uint32_t begin = vertical ? left : top;
+			uint32_t end   = vertical ? right : bottom;
+
+			uint32_t split = begin + 1;
+			uint64_t best  = UINT64_MAX;
+			for(uint32_t i = begin + 1; i < end; ++i)
+			{
+				uint64_t first = vertical
+					? _cost(left, i, top, bottom)
+					: _cost(left, right, top, i);
+				uint64_t second = cost - first;
+				uint64_t delta  = first > second ? first - second : second - first;
+
+				if(delta < best)
+				{
+					best  = delta;
+					split = i;
+				}
+			}
+
+			if(vertical)
+			{
+				_split(left, split, top, bottom, target);
+				_split(split, right, top, bottom, target);
+			}
+			else
+			{
+				_split(left, right, top, split, target);
+				_split(left, right, split, bottom, target);
+			}
+		}
+	public:
+		/* Create a new scheduler with the given cell size, in pixels. The grid
+		 * is empty until `resize()` gets called. */
+		TileScheduler(uint32_t cell = 32)
+			: _cell(cell), _columns(0), _rows(0)
+		{ }
+
+		/* Resize the grid such that it covers a screen of the given size, in
+		 * pixels. This discards all of the recorded costs. */
+		void resize(uint32_t width, uint32_t height)
+		{
+			_columns = (width  + _cell - 1) / _cell;
+			_rows    = (height + _cell - 1) / _cell;
+
+			_costs.assign(_columns * _rows, 0);
+			_sums.assign((_columns + 1) * (_rows + 1), 0);
+			_tiles.clear();
+
+			/* There can never be more tiles than cells, so reserving for that
+			 * keeps scheduling from ever having to allocate. */
+			_tiles.reserve(_columns * _rows);
+		}
+
+		/* Length of the side of a cell, in pixels. */
+		uint32_t cell() const { return _cell; }
+
+		/* Width of the grid, in cells. */
+		uint32_t columns() const { return _columns; }
+
+		/* Height of the grid, in cells. */
+		uint32_t rows() const { return _rows; }
+
+		/* Records the cost of the cell at the given index for this frame.
+		 *
+		 * # Synchronization
+		 * Every cell belongs to exactly one tile, so concurrent calls to this
+		 * function are safe, so long as they come from the tasks running the
+		 * tiles the cells belong to. */
+		void record(uint32_t cell, uint64_t cost)
+		{
+			_costs[cell] = cost;
+		}
+
+		/* Partitions the grid into tiles for the next frame, using the costs
+		 * recorded in this frame, such that the given number of workers gets
+		 * an even share of the work. When no costs have been recorded yet,
+		 * every cell is assumed to have the same cost. */
+		void schedule(uint32_t workers)
+		{
+			_tiles.clear();
+			if(_columns == 0 || _rows == 0)
+				return;
+
+			uint64_t total = 0;
+			for(auto cost : _costs)
+				total += cost;
+
+			for(uint32_t y = 0; y < _rows; ++y)
+				for(uint32_t x = 0; x < _columns; ++x)
+				{
+					uint64_t cost = total == 0 ? 1 : _costs[y * _columns + x];
+					_sums[(y + 1) * (_columns + 1) + (x + 1)] = cost
+						+ _sums[ y      * (_columns + 1) + (x + 1)]
+						+ _sums[(y + 1) * (_columns + 1) +  x     ]
+						- _sums[ y      * (_columns + 1) +  x     ];
+				}
+
+			uint64_t target = _cost(0, _columns, 0, _rows);
+			target /= std::max(workers, 1u) * TILES_PER_WORKER;
+
+			_split(0, _columns, 0, _rows, target);
+			std::sort(_tiles.begin(), _tiles.end(), [](const Tile& a, const Tile& b)
+			{
+				return a.cost > b.cost;
+			});
+		}
+
+		/* Tiles for the current frame, sorted by decreasing cost. */
+		const std::vector<Tile>& tiles() const
+		{
+			return _tiles;
+		}
+	};
+
+	/* Counters of the work done by a raster in a frame.
+	 *
+	 * Most of these get counted by the raster itself. The ones that depend on
+	 * decisions made by the pipeline functions are counted by those functions,
+	 * through `Raster::local_stats()`. */
+	struct alignas(64) RasterStats
+	{
+		/* Triangles dispatched to the raster. */
+		uint64_t submitted = 0;
+
+		/* Triangles the tesselation function had to clip, either partially
+		 * or entirely. Counted by the tesselation function. */
+		uint64_t clipped = 0;
+
+		/* Triangles that fell entirely outside of the scissor rectangle. */
+		uint64_t culled = 0;
+
+		/* Triangles that made it into the bins and got rasterized. */
+		uint64_t rasterized = 0;
+
+		/* Rasterized triangles that were small enough to go through the
+		 * coverage mask path. */
+		uint64_t small = 0;
+
+		/* Fragments handed to the painter. */
+		uint64_t fragments = 0;
+
+		/* Fragments the painter discarded, such as by failing the depth
+		 * test. Counted by the painter. */
+		uint64_t rejected = 0;
+
+		/* Fragments the painter actually wrote to the target. Counted by the
+		 * painter. */
+		uint64_t written = 0;
+
+		RasterStats& operator +=(const RasterStats& other)
+		{
+			submitted  += other.submitted;
+			clipped    += other.clipped;
+			culled     += other.culled;
+			rasterized += other.rasterized;
+			small      += other.small;
+			fragments  += other.fragments;
+			rejected   += other.rejected;
+			written    += other.written;
+
+			return *this;
+		}
+	};
+
+	/* Points that can be written to and read back from a frame capture. */
+	template<typename T>
+	concept CapturablePoint = requires(const T point, std::ostream& out, std::istream& in)
+	{
+		point.write_to_stream(out);
+		{ T::next_from_stream(in) } -> std::same_as<T>;
+	};
+
+	/* Ways in which a raster can decide which triangle is visible at every
+	 * pixel. */
+	enum class Visibility
+	{
+		/* Every fragment of every triangle gets handed to the painter, which
+		 * is expected to decide whether it's visible on its own, such as by
+		 * testing it against a depth buffer. */
+		Depth,
+
+		/* Triangles are resolved against each other one scanline at a time,
+		 * in the style of the span buffers of old, and only the visible spans
+		 * of each are handed to the span painter, with no overdraw at all.
+		 *
+		 * Triangles drawn this way must be opaque and must not intersect each
+		 * other, which is usually the case for static world geometry. In every
+		 * cell, they get drawn before all of the triangles drawn with depth,
+		 * so those can still be tested against the depth of the spans. */
+		Spans
+	};
+
 	template<typename P, typename S>
 		requires Slope<S, P>
 	class Raster
@@ -347,6 +981,11 @@ export namespace gfx
 		/* Given a point, returns a tuple with the coordinates of this point
 		 * in screen space.
 		 *
+		 * Unlike the functions used during setup, this keeps getting called
+		 * during `flush()`, for every triangle dispatched since the last one,
+		 * so it must map all of them the same way, and can't depend on any
+		 * state that changes in between dispatches.
+		 *
 		 * # Synchronization
 		 * Same as transform.
 		 */
@@ -379,6 +1018,8 @@ export namespace gfx
 		 * the current pixel in the space resulting from the previous 
 		 * transformation.
 		 *
+		 * The painter only ever gets called during `flush()`.
+		 *
 		 * # Interpolation
 		 * The interpolation is done by linearly interpolating each dimension of
 		 * the point independently.
@@ -390,6 +1031,27 @@ export namespace gfx
 		 * without the need for external synchronization.
 		 */
 		std::function<void(uint32_t, uint32_t, P)> painter;
+
+		/* Given a point in projected space, returns its depth, with smaller
+		 * values being closer to the viewer. Only used to resolve the
+		 * visibility of triangles drawn with `Visibility::Spans`.
+		 *
+		 * # Synchronization
+		 * Same as transform.
+		 */
+		std::function<float(P)> depth;
+
+		/* Counterpart to the painter for triangles drawn with
+		 * `Visibility::Spans`. Given a scanline Y, followed by the first X of a
+		 * visible span and the X right past its end, along with the points at
+		 * both of these positions. The point at every X in the span can be
+		 * found by interpolating between the two, at (X - X0) / (X1 - X0).
+		 *
+		 * # Synchronization
+		 * Same as the painter. No two invocations of either of them will ever
+		 * overlap the same pixel at the same time.
+		 */
+		std::function<void(uint32_t, uint32_t, uint32_t, P, P)> span_painter;
 	protected:	
 		/* Triangle point bundle. */
 		struct Triangle
@@ -399,58 +1061,382 @@ export namespace gfx
 			P point2;
 		};
 
-		/* This is the thread pool that will be running the rasterization tasks
-		 * on each and every one of our submitted triangles. */
-		thread_pool pool;
-	protected:
-		/* Set up the rasterization by clipping the input triangle. */
-		void clip_rasterize(Triangle t)
+		/* A triangle that has already gone through setup, with its points in
+		 * projected space, along with its bounds in screen space, already
+		 * clipped against the scissor rectangle. */
+		struct Binned
 		{
-			P a, b, c;
-
-			a = t.point0;
-			b = t.point1;
-			c = t.point2;
+			Triangle triangle;
 
-			a = this->transform(a);
-			b = this->transform(b);
-			c = this->transform(c);
+			int32_t left;
+			int32_t right;
+			int32_t top;
+			int32_t bottom;
 
-			this->tesselation(
-				a, b, c,
-				[&](P i, P j, P k)
-				{
-					Triangle t;
-					t.point0 = i;
-					t.point1 = j;
-					t.point2 = k;
-					this->rasterize(t);
-				});
-		}
+			/* How the visibility of this triangle gets resolved. */
+			Visibility visibility;
+		};
 
-		/* Actually perform the raster operation using the given triangle. */
-		void rasterize(Triangle t)
+		/* A row of a triangle drawn with `Visibility::Spans`, waiting to be
+		 * resolved against all of the other rows in the same scanline. */
+		struct Span
 		{
-			P a, b, c;
-
-			a = t.point0;
-			b = t.point1;
-			c = t.point2;
+			int32_t y;
 
-			a = this->project(a);
-			b = this->project(b);
-			c = this->project(c);
+			/* Extent of the whole row, from X0 up to, but not including, X1,
+			 * along with the points and depths at both ends. */
+			int32_t x0, x1;
+			P p0, p1;
+			float z0, z1;
 
-			auto [x0, y0, x1, y1, x2, y2] = std::tuple_cat(
-				this->screen(a),
-				this->screen(b),
-				this->screen(c));
+			/* Pixels of the row inside of the cell being drawn. */
+			int32_t left, right;
 
+			/* Point at the given X, anywhere along the row. */
+			template<typename L>
+			P at(L& slope, int32_t x) const
+			{
+				return slope(p0, p1).at((double) (x - x0) / (double) (x1 - x0));
+			}
 
-			/* Sort the points primarily by increasing Y and, secondy, by increasing X. */
-			if(std::tie(y0, x0) > std::tie(y1, x1)) { std::swap(a, b); std::swap(y0, y1); std::swap(x0, x1); }
-			if(std::tie(y1, x1) > std::tie(y2, x2)) { std::swap(b, c); std::swap(y1, y2); std::swap(x1, x2); }
-			if(std::tie(y0, x0) > std::tie(y1, x1)) { std::swap(a, b); std::swap(y0, y1); std::swap(x0, x1); }
+			/* Depth at the given X, anywhere along the row. */
+			float depth(double x) const
+			{
+				return z0 + (z1 - z0) * (float) ((x - x0) / (double) (x1 - x0));
+			}
+		};
+
+		/* A visible span waiting to be painted. */
+		struct Resolved
+		{
+			uint32_t y;
+			uint32_t x0, x1;
+			P p0, p1;
+		};
+
+		/* A fragment waiting to be painted. */
+		struct Fragment
+		{
+			uint32_t x;
+			uint32_t y;
+			P point;
+		};
+
+		/* Triangles that went through setup in a given worker. Each worker has
+		 * its own bin, such that no synchronization is needed during setup.
+		 *
+		 * All of the storage for a bin lives in its arena, which is reset at
+		 * the end of every frame. */
+		struct Bin
+		{
+			/* Storage for the triangles in this bin. */
+			Arena arena;
+
+			/* Storage for data needed by the raster jobs running in this
+			 * worker, such as buffered fragments. */
+			Arena scratch;
+
+			/* All of the triangles set up by this worker in this frame. */
+			ArenaVector<Binned> triangles;
+
+			/* Indices into the triangle list of the triangles that overlap
+			 * each of the cells of the tile scheduler. */
+			std::vector<ArenaVector<uint32_t>> cells;
+
+			Bin()
+				: triangles(ArenaAllocator<Binned>(arena))
+			{ }
+
+			/* Drop all of the triangles in this bin, and reset its arena. */
+			void reset(size_t cells)
+			{
+				triangles = ArenaVector<Binned>(ArenaAllocator<Binned>(arena));
+
+				this->cells.resize(cells, ArenaVector<uint32_t>(ArenaAllocator<uint32_t>(arena)));
+				for(auto& cell : this->cells)
+					cell = ArenaVector<uint32_t>(ArenaAllocator<uint32_t>(arena));
+
+				arena.reset();
+				scratch.reset();
+			}
+		};
+
+		/* Largest extent, in pixels, along either axis, of the bounds of the
+		 * triangles that get drawn by `rasterize_small()`. Must be at most 8,
+		 * as the coverage of these triangles is kept in a 64-bit mask. */
+		static constexpr int32_t SMALL_SIZE = 8;
+
+		/* Number of triangles set up by every job. Batching triangles keeps
+		 * the number of jobs, and with it the overhead of the pool, down. */
+		static constexpr uint32_t BATCH_SIZE = 64;
+
+		/* A batch of triangles, along with the job that sets them up. */
+		struct Batch
+		{
+			Raster *raster;
+			Triangle *triangles;
+			uint32_t count;
+			Visibility visibility;
+			uint32_t draw;
+
+			void operator ()(uint32_t worker)
+			{
+				if(raster->dropped())
+					return;
+
+				_local_stats = &raster->_stats[worker];
+				_local_stats->submitted += count;
+				_local_draw = draw;
+
+				/* Transform the whole batch before setting any of it up, such
+				 * that both stages can be told apart by the counters. */
+				{
+					perf_scope scope(perf_stage::vertex);
+					for(uint32_t i = 0; i < count; ++i)
+						raster->vertex(triangles[i]);
+				}
+				{
+					perf_scope scope(perf_stage::setup);
+					for(uint32_t i = 0; i < count; ++i)
+						raster->setup(triangles[i], visibility, worker);
+				}
+			}
+		};
+
+		/* A job that rasterizes a single tile. */
+		struct TileJob
+		{
+			Raster *raster;
+			const TileScheduler::Tile *tile;
+
+			void operator ()(uint32_t worker)
+			{
+				if(raster->dropped())
+					return;
+
+				_local_stats = &raster->_stats[worker];
+				raster->raster_tile(*tile, worker);
+			}
+		};
+
+		/* This is the thread pool that will be running the rasterization tasks
+		 * on each and every one of our submitted triangles. */
+		thread_pool pool;
+
+		/* Extent of the target, in pixels. */
+		uint32_t _width, _height;
+
+		/* Scheduler used to hand the screen out to the workers. */
+		TileScheduler _scheduler;
+
+		/* NUMA nodes the workers and the target are placed on. */
+		numa_topology _topology;
+
+		/* Per-worker triangle bins. */
+		std::vector<Bin> _bins;
+
+		/* Storage for the data only needed by the submitting thread during a
+		 * frame, such as batches and jobs. Reset at the end of every frame. */
+		Arena _frame;
+
+		/* Batch currently being filled by dispatch, if any. */
+		Batch *_pending;
+
+		/* Outstanding setup and raster jobs. The pool marks them done, the
+		 * groups themselves are never cancelled. */
+		task_group _setup;
+		task_group _tiles;
+
+		/* Number of times the raster has been cancelled, and its value when
+		 * the frame in flight began. A frame is dropped once they differ.
+		 * Being a single counter, a cancel racing with the end of a frame
+		 * either drops that frame or the next one, as a whole, rather than
+		 * leaving a stage of the next frame dropped and the other not. */
+		std::atomic<uint64_t> _cancels;
+		uint64_t _epoch;
+
+		/* Per-worker counters for the frame in flight. */
+		std::vector<RasterStats> _stats;
+
+		/* Counters of the last flushed frame. */
+		RasterStats _last_stats;
+
+		/* Counters of the worker the current thread is running a job for. */
+		static inline thread_local RasterStats *_local_stats = nullptr;
+
+		/* Visibility of the triangles being dispatched. */
+		Visibility _visibility;
+
+		/* Draw the triangles being dispatched belong to, and the one of the
+		 * batch the current thread is setting up. */
+		uint32_t _draw;
+		static inline thread_local uint32_t _local_draw = 0;
+
+		/* Stream every flushed frame gets captured to, if any. */
+		std::ostream *_capture;
+
+		/* Tag at the start of every frame in a capture, "QOFR". */
+		static constexpr uint32_t CAPTURE_MAGIC = 0x52464f51;
+	protected:
+		/* Write a 32-bit unsigned integer to a stream, in little endian. */
+		static void write_uint32_le(std::ostream& out, uint32_t value)
+		{
+			char buf[4];
+			for(uint32_t i = 0; i < 4; ++i)
+				buf[i] = (char) ((value >> (i * 8)) & 0xff);
+			out.write(buf, 4);
+		}
+
+		/* Read a 32-bit unsigned integer from a stream, in little endian. */
+		static bool next_uint32_le(std::istream& in, uint32_t& value)
+		{
+			unsigned char buf[4];
+			if(!in.read((char*) buf, 4))
+				return false;
+
+			value = 0;
+			for(uint32_t i = 0; i < 4; ++i)
+				value |= (uint32_t) buf[i] << (i * 8);
+			return true;
+		}
+
+		/* Write all of the triangles binned in this frame to the capture
+		 * stream, along with the state needed to draw them again. */
+		void write_capture(std::ostream& out) requires CapturablePoint<P>
+		{
+			uint32_t count = 0;
+			for(const auto& bin : _bins)
+				count += bin.triangles.size();
+
+			write_uint32_le(out, CAPTURE_MAGIC);
+			write_uint32_le(out, _width);
+			write_uint32_le(out, _height);
+			write_uint32_le(out, count);
+
+			for(const auto& bin : _bins)
+				for(const auto& b : bin.triangles)
+				{
+					write_uint32_le(out, (uint32_t) b.left);
+					write_uint32_le(out, (uint32_t) b.right);
+					write_uint32_le(out, (uint32_t) b.top);
+					write_uint32_le(out, (uint32_t) b.bottom);
+					write_uint32_le(out, (uint32_t) b.visibility);
+
+					b.triangle.point0.write_to_stream(out);
+					b.triangle.point1.write_to_stream(out);
+					b.triangle.point2.write_to_stream(out);
+				}
+		}
+
+		/* Append a triangle that has already been set up to the bin of the
+		 * given worker, and to the lists of all of the cells it overlaps. */
+		void insert(const Binned& binned, uint32_t worker)
+		{
+			Bin& bin = _bins[worker];
+			uint32_t index = bin.triangles.size();
+			bin.triangles.push_back(binned);
+
+			uint32_t cell = _scheduler.cell();
+			for(uint32_t y = binned.top / cell; y <= binned.bottom / cell; ++y)
+				for(uint32_t x = binned.left / cell; x <= binned.right / cell; ++x)
+					bin.cells[y * _scheduler.columns() + x].push_back(index);
+		}
+
+		/* Apply the transform function to all of the points in a triangle. */
+		void vertex(Triangle& t)
+		{
+			t.point0 = this->transform(t.point0);
+			t.point1 = this->transform(t.point1);
+			t.point2 = this->transform(t.point2);
+		}
+
+		/* Set up the rasterization by clipping the input triangle, which must
+		 * have already been transformed, and binning the resulting triangles
+		 * into the bin of the given worker. */
+		void setup(Triangle t, Visibility visibility, uint32_t worker)
+		{
+			/* Capture everything through a single reference, as closures any
+			 * larger than that make std::function allocate. */
+			struct
+			{
+				Raster *raster;
+				Visibility visibility;
+				uint32_t worker;
+			} target { this, visibility, worker };
+
+			this->tesselation(
+				t.point0, t.point1, t.point2,
+				[&target](P i, P j, P k)
+				{
+					Triangle t;
+					t.point0 = i;
+					t.point1 = j;
+					t.point2 = k;
+					target.raster->bin(t, target.visibility, target.worker);
+				});
+		}
+
+		/* Project the given triangle and bin it into all of the cells it
+		 * overlaps in the bin of the given worker. */
+		void bin(Triangle t, Visibility visibility, uint32_t worker)
+		{
+			t.point0 = this->project(t.point0);
+			t.point1 = this->project(t.point1);
+			t.point2 = this->project(t.point2);
+
+			auto [x0, y0, x1, y1, x2, y2] = std::tuple_cat(
+				this->screen(t.point0),
+				this->screen(t.point1),
+				this->screen(t.point2));
+
+			/* Clip the bounds of the triangle against the scissor and the
+			 * target, culling it if nothing is left. */
+			auto [left, right, top, bottom] = this->scissor();
+			
+			Binned binned;
+			binned.triangle = t;
+			binned.visibility = visibility;
+			binned.left   = std::max({ std::min({ x0, x1, x2 }), left,   0 });
+			binned.right  = std::min({ std::max({ x0, x1, x2 }), right,  (int32_t) _width  - 1 });
+			binned.top    = std::max({ std::min({ y0, y1, y2 }), top,    0 });
+			binned.bottom = std::min({ std::max({ y0, y1, y2 }), bottom, (int32_t) _height - 1 });
+
+			if(binned.left > binned.right || binned.top > binned.bottom)
+			{
+				_stats[worker].culled++;
+				return;
+			}
+			_stats[worker].rasterized++;
+			if(is_small(binned) && visibility == Visibility::Depth)
+				_stats[worker].small++;
+
+			this->insert(binned, worker);
+		}
+
+		/* Walk the rows of the given projected triangle, from its top down to
+		 * the given bottom, starting no earlier than the given top. For every
+		 * row, the given function gets the Y of the row, followed by the X of
+		 * its first pixel and the X right past its last one, along with the
+		 * points at both of these positions. */
+		template<typename F>
+		void scan(Triangle t, int32_t top, int32_t bottom, F&& row)
+		{
+			P a, b, c;
+
+			a = t.point0;
+			b = t.point1;
+			c = t.point2;
+
+			auto [x0, y0, x1, y1, x2, y2] = std::tuple_cat(
+				this->screen(a),
+				this->screen(b),
+				this->screen(c));
+
+
+			/* Sort the points primarily by increasing Y and, secondy, by increasing X. */
+			if(std::tie(y0, x0) > std::tie(y1, x1)) { std::swap(a, b); std::swap(y0, y1); std::swap(x0, x1); }
+			if(std::tie(y1, x1) > std::tie(y2, x2)) { std::swap(b, c); std::swap(y1, y2); std::swap(x1, x2); }
+			if(std::tie(y0, x0) > std::tie(y1, x1)) { std::swap(a, b); std::swap(y0, y1); std::swap(x0, x1); }
 
 			/* Side of the shortest slope. */
 			bool shortside = (y1 - y0) * (x2 - x0) < (x1 - x0) * (y2 - y0);
@@ -463,9 +1449,6 @@ export namespace gfx
 				shortside == 1 ? this->slope(a, b) : this->slope(a, c)
 			};
 
-			/* Get the scissor. */
-			auto [left, right, top, bottom] = this->scissor();
-
 			auto ye = y1;
 			auto yt = y0;
 			for(int32_t y = std::max(y0, top); y <= bottom; ++y)
@@ -491,6 +1474,25 @@ export namespace gfx
 				auto x1 = std::get<0>(this->screen(p1));
 				if(x0 > x1) { std::swap(x0, x1); std::swap(p0, p1); }
 
+				row(y, x0, x1, p0, p1);
+			}
+		}
+
+		/* Actually perform the raster operation using the given projected
+		 * triangle, limiting it to the given scissor rectangle. Every fragment
+		 * generated gets handed to the given function, which is expected to
+		 * behave just like the painter. */
+		template<typename F>
+		void rasterize(
+			Triangle t, 
+			int32_t left, int32_t right, int32_t top, int32_t bottom,
+			F&& emit)
+		{
+			this->scan(t, top, bottom, [&](int32_t y, int32_t x0, int32_t x1, const P& p0, const P& p1)
+			{
+				if(std::max(x0, left) >= x1 || std::max(x0, left) > right)
+					return;
+
 				S slope = this->slope(p0, p1);
 				for(int32_t x = std::max(x0, left); x < x1 && x <= right; ++x)
 				{
@@ -502,11 +1504,385 @@ export namespace gfx
 					 * modifying this one pixel value. */ 
 					/*if(x < 0 || y < 0 || x > (int32_t) right || y > (int32_t) bottom )
 						throw std::runtime_error("invalid pixel shader invocation coordinate");*/
-					this->painter((uint32_t) x, (uint32_t) y, p);
+					emit((uint32_t) x, (uint32_t) y, p);
+				}
+			});
+		}
+
+		/* Resolve the visibility of the given rows, which must all lie inside
+		 * of the same cell, handing every visible span over to the given
+		 * function, which is expected to behave just like the span painter.
+		 *
+		 * Rows get sorted by scanline and, for every scanline, the edges of
+		 * all of its rows are sorted, such that between any two consecutive
+		 * edges the same rows are always in. Of those, the one closest to the
+		 * viewer at the middle of the interval is the visible one, and
+		 * consecutive intervals won by the same row are painted as a single
+		 * span. */
+		template<typename F>
+		void resolve(ArenaVector<Span>& spans, ArenaVector<int32_t>& edges, F&& emit)
+		{
+			std::sort(spans.begin(), spans.end(),
+				[](const Span& a, const Span& b) { return a.y < b.y; });
+
+			auto span = [&](const Span& s, int32_t x0, int32_t x1)
+			{
+				emit(
+					(uint32_t) s.y, (uint32_t) x0, (uint32_t) x1,
+					s.at(this->slope, x0),
+					s.at(this->slope, x1));
+			};
+
+			for(size_t first = 0, last; first < spans.size(); first = last)
+			{
+				int32_t y = spans[first].y;
+				for(last = first; last < spans.size() && spans[last].y == y; ++last)
+					;
+
+				edges.clear();
+				for(size_t i = first; i < last; ++i)
+				{
+					edges.push_back(spans[i].left);
+					edges.push_back(spans[i].right + 1);
+				}
+				std::sort(edges.begin(), edges.end());
+				edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+				const Span *owner = nullptr;
+				int32_t start = 0;
+				for(size_t k = 0; k + 1 < edges.size(); ++k)
+				{
+					int32_t xa = edges[k];
+					int32_t xb = edges[k + 1];
+					double middle = 0.5 * (double) (xa + xb - 1);
+
+					const Span *best = nullptr;
+					float closest = 0.0f;
+					for(size_t i = first; i < last; ++i)
+					{
+						const Span& s = spans[i];
+						if(s.left > xa || s.right < xb - 1)
+							continue;
+
+						float z = s.depth(middle);
+						if(best == nullptr || z < closest)
+						{
+							best = &s;
+							closest = z;
+						}
+					}
+
+					if(best != owner)
+					{
+						if(owner != nullptr)
+							span(*owner, start, xa);
+						owner = best;
+						start = xa;
+					}
 				}
+				if(owner != nullptr)
+					span(*owner, start, edges.back());
 			}
 		}
 
+		/* Whether the given triangle should be drawn by `rasterize_small()`. */
+		static bool is_small(const Binned& b)
+		{
+			return b.right - b.left < SMALL_SIZE && b.bottom - b.top < SMALL_SIZE;
+		}
+
+		/* Rasterize a triangle whose bounds are no larger than SMALL_SIZE on
+		 * either axis, limiting it to the given scissor rectangle.
+		 *
+		 * For triangles this small, setting up the slopes of the scanline path
+		 * in `rasterize()` costs far more than drawing their handful of pixels.
+		 * Instead, the coverage of the whole triangle is found up front with
+		 * integer edge functions, sampled at the center of every pixel using
+		 * the top-left fill rule, and slopes are only created for the rows that
+		 * turn out to have any pixels in them.
+		 *
+		 * The fill rule keeps small triangles sharing an edge watertight among
+		 * themselves, but it doesn't exactly match the rounding of the scanline
+		 * path, so a pixel along an edge shared with a larger triangle may be
+		 * covered by both or by neither. */
+		template<typename F>
+		void rasterize_small(
+			Triangle t,
+			int32_t left, int32_t right, int32_t top, int32_t bottom,
+			F&& emit)
+		{
+			P a = t.point0;
+			P b = t.point1;
+			P c = t.point2;
+
+			auto [x0, y0, x1, y1, x2, y2] = std::tuple_cat(
+				this->screen(a),
+				this->screen(b),
+				this->screen(c));
+
+			/* Work in doubled coordinates, such that the center of the pixel
+			 * at (x, y), which is sampled at (x + 0.5, y), lands on integers. */
+			int64_t ax = 2 * (int64_t) x0, ay = 2 * (int64_t) y0;
+			int64_t bx = 2 * (int64_t) x1, by = 2 * (int64_t) y1;
+			int64_t cx = 2 * (int64_t) x2, cy = 2 * (int64_t) y2;
+
+			int64_t area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+			if(area == 0)
+				/* Degenerate triangles don't cover anything. */
+				return;
+			if(area < 0)
+			{
+				std::swap(b, c);
+				std::swap(bx, cx);
+				std::swap(by, cy);
+				area = -area;
+			}
+
+			/* An edge function for every edge, each being the weight of the
+			 * vertex opposite to it, scaled by the area. */
+			struct Edge
+			{
+				int64_t w;	/* Value at the first pixel of the current row. */
+				int64_t dx;	/* Change between horizontal neighbors. */
+				int64_t dy;	/* Change between vertical neighbors. */
+				int64_t bias;	/* Pushes excluded edges out of the triangle. */
+			};
+			auto make = [&](int64_t ux, int64_t uy, int64_t vx, int64_t vy)
+			{
+				int64_t px = 2 * (int64_t) left + 1;
+				int64_t py = 2 * (int64_t) top;
+
+				/* With Y pointing down, top edges run right and left edges
+				 * run up. Only those keep the samples lying right on them. */
+				bool topleft = (vy == uy && vx > ux) || vy < uy;
+
+				return Edge
+				{
+					.w    = (vx - ux) * (py - uy) - (vy - uy) * (px - ux),
+					.dx   = -(vy - uy) * 2,
+					.dy   =  (vx - ux) * 2,
+					.bias = topleft ? 0 : -1
+				};
+			};
+			Edge e0 = make(bx, by, cx, cy);
+			Edge e1 = make(cx, cy, ax, ay);
+			Edge e2 = make(ax, ay, bx, by);
+
+			/* Find the coverage of the whole rectangle, one bit per pixel, in
+			 * rows of SMALL_SIZE bits. */
+			uint64_t mask = 0;
+			for(int32_t y = 0; y <= bottom - top; ++y)
+			{
+				int64_t w0 = e0.w + e0.bias;
+				int64_t w1 = e1.w + e1.bias;
+				int64_t w2 = e2.w + e2.bias;
+				for(int32_t x = 0; x <= right - left; ++x)
+				{
+					if((w0 | w1 | w2) >= 0)
+						mask |= uint64_t(1) << (y * SMALL_SIZE + x);
+
+					w0 += e0.dx;
+					w1 += e1.dx;
+					w2 += e2.dx;
+				}
+
+				e0.w += e0.dy;
+				e1.w += e1.dy;
+				e2.w += e2.dy;
+			}
+			if(mask == 0)
+				return;
+
+			/* Interpolate using slopes only, as that's all a point supports.
+			 * Walking the same distance along the edges from A to B and from A
+			 * to C leads to a segment on which the point lies. */
+			S ab = this->slope(a, b);
+			S ac = this->slope(a, c);
+			auto at = [&](int32_t x, int32_t y)
+			{
+				int64_t px = 2 * (int64_t) x + 1;
+				int64_t py = 2 * (int64_t) y;
+
+				double l1 = (double) ((ax - cx) * (py - cy) - (ay - cy) * (px - cx)) / (double) area;
+				double l2 = (double) ((bx - ax) * (py - ay) - (by - ay) * (px - ax)) / (double) area;
+				double s  = l1 + l2;
+				if(s <= 0.0)
+					return a;
+
+				return this->slope(ab.at(s), ac.at(s)).at(l2 / s);
+			};
+
+			for(int32_t y = 0; y <= bottom - top; ++y)
+			{
+				uint64_t row = (mask >> (y * SMALL_SIZE)) & ((uint64_t(1) << SMALL_SIZE) - 1);
+				if(row == 0)
+					continue;
+
+				/* Triangles are convex, so every row is a single span. */
+				int32_t x0 = std::countr_zero(row);
+				int32_t x1 = SMALL_SIZE - 1 - std::countl_zero(row << (64 - SMALL_SIZE));
+
+				P p0 = at(left + x0, top + y);
+				if(x0 == x1)
+				{
+					emit((uint32_t) (left + x0), (uint32_t) (top + y), p0);
+					continue;
+				}
+
+				P p1 = at(left + x1, top + y);
+				S slope = this->slope(p0, p1);
+				for(int32_t x = x0; x <= x1; ++x)
+				{
+					double posX = (double) (x - x0) / (double) (x1 - x0);
+					emit((uint32_t) (left + x), (uint32_t) (top + y), slope.at(posX));
+				}
+			}
+		}
+
+		/* Rasterize all of the triangles binned into the cells of the given
+		 * tile, recording the cost of every cell into the scheduler.
+		 *
+		 * While performance counters are being sampled, the fragments of every
+		 * cell are buffered and only painted after the whole cell has been
+		 * rasterized, such that raster and painter costs can be told apart. */
+		void raster_tile(const TileScheduler::Tile& tile, uint32_t worker)
+		{
+			using Clock = std::chrono::steady_clock;
+
+			perf_scope scope(perf_stage::raster);
+			bool split = perf_enabled();
+			ArenaVector<Fragment> fragments(ArenaAllocator<Fragment>(_bins[worker].scratch));
+			ArenaVector<Resolved> resolved(ArenaAllocator<Resolved>(_bins[worker].scratch));
+			ArenaVector<Span> spans(ArenaAllocator<Span>(_bins[worker].scratch));
+			ArenaVector<int32_t> edges(ArenaAllocator<int32_t>(_bins[worker].scratch));
+			RasterStats& stats = _stats[worker];
+
+			auto paint = [&](uint32_t x, uint32_t y, P p)
+			{
+				stats.fragments++;
+				this->painter(x, y, p);
+			};
+			auto buffer = [&](uint32_t x, uint32_t y, P p)
+			{
+				stats.fragments++;
+				fragments.push_back({ x, y, p });
+			};
+			auto paint_span = [&](uint32_t y, uint32_t x0, uint32_t x1, P p0, P p1)
+			{
+				stats.fragments += x1 - x0;
+				this->span_painter(y, x0, x1, p0, p1);
+			};
+			auto buffer_span = [&](uint32_t y, uint32_t x0, uint32_t x1, P p0, P p1)
+			{
+				stats.fragments += x1 - x0;
+				resolved.push_back({ y, x0, x1, p0, p1 });
+			};
+
+			uint32_t size = _scheduler.cell();
+			for(uint32_t y = tile.top; y < tile.bottom; ++y)
+				for(uint32_t x = tile.left; x < tile.right; ++x)
+				{
+					/* Cells are the safe points of a dropped frame. */
+					if(dropped())
+						return;
+
+					auto begin = Clock::now();
+
+					uint32_t cell = y * _scheduler.columns() + x;
+					int32_t left   = x * size;
+					int32_t right  = std::min((x + 1) * size, _width)  - 1;
+					int32_t top    = y * size;
+					int32_t bottom = std::min((y + 1) * size, _height) - 1;
+
+					/* Spans go first, so that the depth they leave behind can
+					 * be tested against by everything else. */
+					for(const auto& bin : _bins)
+						for(auto index : bin.cells[cell])
+						{
+							const Binned& b = bin.triangles[index];
+							if(b.visibility != Visibility::Spans)
+								continue;
+
+							auto l = std::max(b.left,   left);
+							auto r = std::min(b.right,  right);
+							auto t = std::max(b.top,    top);
+							auto d = std::min(b.bottom, bottom);
+
+							this->scan(b.triangle, t, d, [&](int32_t y, int32_t x0, int32_t x1, const P& p0, const P& p1)
+							{
+								int32_t sl = std::max(x0, l);
+								int32_t sr = std::min(x1 - 1, r);
+								if(sl > sr)
+									return;
+
+								spans.push_back(Span
+								{
+									.y  = y,
+									.x0 = x0, .x1 = x1,
+									.p0 = p0, .p1 = p1,
+									.z0 = this->depth(p0),
+									.z1 = this->depth(p1),
+									.left = sl, .right = sr
+								});
+							});
+						}
+					if(!spans.empty())
+					{
+						if(split)
+						{
+							this->resolve(spans, edges, buffer_span);
+
+							perf_scope scope(perf_stage::painter);
+							for(const auto& s : resolved)
+								this->span_painter(s.y, s.x0, s.x1, s.p0, s.p1);
+							resolved.clear();
+						}
+						else
+							this->resolve(spans, edges, paint_span);
+						spans.clear();
+					}
+
+					for(const auto& bin : _bins)
+						for(auto index : bin.cells[cell])
+						{
+							const Binned& b = bin.triangles[index];
+							if(b.visibility != Visibility::Depth)
+								continue;
+
+							auto l = std::max(b.left,   left);
+							auto r = std::min(b.right,  right);
+							auto t = std::max(b.top,    top);
+							auto d = std::min(b.bottom, bottom);
+
+							auto draw = [&](auto& emit)
+							{
+								if(is_small(b))
+									this->rasterize_small(b.triangle, l, r, t, d, emit);
+								else
+									this->rasterize(b.triangle, l, r, t, d, emit);
+							};
+
+							if(split)
+								draw(buffer);
+							else
+								draw(paint);
+						}
+
+					if(split)
+					{
+						perf_scope scope(perf_stage::painter);
+						for(const auto& f : fragments)
+							this->painter(f.x, f.y, f.point);
+						fragments.clear();
+					}
+
+					auto end = Clock::now();
+					_scheduler.record(
+						cell,
+						std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+				}
+		}
+
 		/* Calculate an approximate double area value for the triangle. */
 		uint64_t darea(const Triangle t)
 		{
@@ -564,14 +1940,59 @@ export namespace gfx
 			t1 = a1;
 		}
 	
+		/* Releases all of the transient storage of the frame, and readies
+		 * the raster for the next one. Must only be called once no jobs of
+		 * the frame are left. */
+		void discard()
+		{
+			for(auto& bin : _bins)
+				bin.reset(_scheduler.columns() * _scheduler.rows());
+			_frame.reset();
+			_pending = nullptr;
+
+			for(auto& stats : _stats)
+				stats = RasterStats();
+
+			_epoch = _cancels.load(std::memory_order_acquire);
+		}
+
+		/* Whether the frame in flight has been cancelled. Jobs of a dropped
+		 * frame return as soon as they see this. */
+		bool dropped() const noexcept
+		{
+			return _cancels.load(std::memory_order_acquire) != _epoch;
+		}
+
 	public:
+		/* Creates a raster with as many workers as there are hardware
+		 * threads. */
 		Raster()
+			: Raster(thread_pool::default_concurrency())
+		{ }
+
+		/* Creates a raster with the given number of workers. */
+		explicit Raster(uint32_t threads)
+			: Raster(threads, threads)
+		{ }
+
+		/* Creates a raster with up to `max_threads` workers, of which only
+		 * as many as needed, but never less than `min_threads`, get work. See
+		 * `adapt()`. */
+		Raster(uint32_t min_threads, uint32_t max_threads)
 			/* Create the thread pool. 
 			 * 
 			 * This will create a new unbalanced thread pool (which should not
-			 * be a problem, given it's work stealing) with as many workers as
-			 * there are hardware threads. */
-			: pool(thread_pool::default_concurrency())
+			 * be a problem, given it's work stealing). */
+			: pool(min_threads, max_threads),
+			  _width(0), _height(0),
+			  _bins(pool.size()),
+			  _pending(nullptr),
+			  _cancels(0),
+			  _epoch(0),
+			  _stats(pool.size()),
+			  _visibility(Visibility::Depth),
+			  _draw(0),
+			  _capture(nullptr)
 		{
 			/* Since C++ gets really bloated and hard to read at the mildest of
 			 * things and, no doubt, to generate a compile time error for the 
@@ -617,12 +2038,26 @@ export namespace gfx
 				auto what = u8"raster call missing painter function"_fb;
 				throw std::runtime_error(what);
 			};
+			this->depth = [](P) -> float
+			{
+				auto what = u8"raster call missing depth function"_fb;
+				throw std::runtime_error(what);
+			};
+			this->span_painter = [](auto, auto, auto, auto, auto)
+			{
+				auto what = u8"raster call missing span painter function"_fb;
+				throw std::runtime_error(what);
+			};
 		}
 
 		/* Dispatches the rendering of a triangle, given the coordinates for its
-		 * three vertices. This function returns a future that will be complete
-		 * when the triangle has been completely drawn. */
-		void dispatch(P p0, P p1, P p2, std::vector<std::future<void>>& futures, size_t /*tessels*/ = 0)
+		 * three vertices. Triangles are set up in batches, in the background,
+		 * and only get drawn by the next call to `flush()`.
+		 *
+		 * Use `wait()` to make sure all of the triangles dispatched so far have
+		 * been set up, which is needed before changing any of the functions
+		 * used during setup, such as `transform`. */
+		void dispatch(P p0, P p1, P p2, size_t /*tessels*/ = 0)
 		{
 			/* Build the triangle structure. */
 			Triangle triangle = 
@@ -646,16 +2081,345 @@ export namespace gfx
 				Triangle t0, t1;
 				bissect(triangle, t0, t1);
 			
-				dispatch(t0.point0, t0.point1, t0.point2, futures, TESSEL_MAX + 1);
-				dispatch(t1.point0, t1.point1, t1.point2, futures, TESSEL_MAX + 1);
+				dispatch(t0.point0, t0.point1, t0.point2, TESSEL_MAX + 1);
+				dispatch(t1.point0, t1.point1, t1.point2, TESSEL_MAX + 1);
 			}*/
 
-			/* We're satistifed with the size of the fragment. So submit it. */
-			auto task = make_task<void>([triangle, this]() 
-			{	
-				this->clip_rasterize(triangle);
-			});
-			futures.push_back(this->pool.submit_task(task));
+			/* We're satistifed with the size of the fragment. So batch it. */
+			if(_pending == nullptr)
+				_pending = _frame.make<Batch>(Batch
+				{
+					.raster     = this,
+					.triangles  = _frame.allocate<Triangle>(BATCH_SIZE),
+					.count      = 0,
+					.visibility = _visibility,
+					.draw       = _draw
+				});
+
+			new (&_pending->triangles[_pending->count++]) Triangle(triangle);
+			if(_pending->count == BATCH_SIZE)
+				this->submit();
+		}
+
+		/* Sets how the visibility of the triangles dispatched from now on is
+		 * going to be resolved. `Visibility::Depth` by default. */
+		void visibility(Visibility visibility)
+		{
+			if(visibility != _visibility)
+				this->submit();
+			_visibility = visibility;
+		}
+
+		/* Visibility of the triangles being dispatched. */
+		Visibility visibility() const noexcept
+		{
+			return _visibility;
+		}
+
+		/* Sets the draw the triangles dispatched from now on belong to, zero
+		 * by default. The raster makes nothing of it, other than handing it
+		 * to the functions used during setup through `local_draw()`, such
+		 * that they can tell the state of every draw apart, rather than all
+		 * of them reading the same state, which could only be changed once
+		 * the previous draw had been set up. */
+		void draw(uint32_t draw)
+		{
+			if(draw != _draw)
+				this->submit();
+			_draw = draw;
+		}
+
+		/* Submits the batch currently being filled, if any, for setup. */
+		void submit()
+		{
+			if(_pending == nullptr)
+				return;
+
+			_setup.add();
+			this->pool.submit_job(make_job(*_pending, _setup));
+			_pending = nullptr;
+		}
+
+		/* Blocks until all of the triangles dispatched so far have been set
+		 * up and binned. */
+		void wait()
+		{
+			this->submit();
+			_setup.wait();
+		}
+
+		/* Sets the size of the target the triangles are going to be drawn to,
+		 * in pixels. Triangles dispatched for the old size can't be drawn to
+		 * the new one, so the frame in flight, if any, gets dropped. */
+		void viewport(uint32_t width, uint32_t height)
+		{
+			this->cancel();
+			this->wait();
+
+			_width  = width;
+			_height = height;
+
+			_scheduler.resize(width, height);
+			_scheduler.schedule(this->pool.active());
+
+			this->discard();
+		}
+
+		/* Drops the frame in flight, that is, everything dispatched since the
+		 * last flush. Jobs of the frame that haven't started yet never run, and
+		 * the ones drawing tiles stop at the next cell, so the workers are
+		 * free right away. The next call to `flush()`, or the current one, if
+		 * any, returns as soon as that happens, leaving the target partially
+		 * drawn, and the frame's counters out of `stats()`.
+		 *
+		 * This may be called from any thread. */
+		void cancel() noexcept
+		{
+			_cancels.fetch_add(1, std::memory_order_acq_rel);
+		}
+
+		/* Rasterizes all of the triangles dispatched since the last flush,
+		 * blocking until they have been completely drawn.
+		 *
+		 * Calling this function once per frame is expected, as it's at this
+		 * point that the costs measured for every tile are used to schedule the
+		 * next frame, and that all of the transient storage of the frame gets
+		 * released. */
+		void flush()
+		{
+			this->wait();
+			if(this->dropped())
+			{
+				this->discard();
+				return;
+			}
+
+			if constexpr(CapturablePoint<P>)
+				if(_capture != nullptr)
+					this->write_capture(*_capture);
+
+			/* Hand the tiles out largest-first, always to the worker with the
+			 * least amount of predicted work. Only active workers get tiles,
+			 * parked ones keep sleeping. */
+			uint32_t workers = this->pool.active();
+			uint64_t *loads  = _frame.allocate<uint64_t>(workers);
+			std::fill(loads, loads + workers, 0);
+
+			const auto& tiles = _scheduler.tiles();
+			TileJob *jobs = _frame.allocate<TileJob>(tiles.size());
+
+			/* With more than one NUMA node, prefer the workers on the node
+			 * the rows of the tile live on. A tile only goes to a remote
+			 * worker when that gets it done earlier than a local one would
+			 * even start it, as remote memory is slower, but not idle. */
+			uint32_t nodes = _topology.nodes();
+
+			_tiles.add(tiles.size());
+			for(size_t i = 0; i < tiles.size(); ++i)
+			{
+				auto worker = std::min_element(loads, loads + workers) - loads;
+
+				uint32_t row  = (tiles[i].top + tiles[i].bottom) * _scheduler.cell() / 2;
+				uint32_t node = _topology.node_of_row(std::min(row, _height - 1), _height);
+				if(nodes > 1 && node < workers)
+				{
+					uint32_t local = node;
+					for(uint32_t j = node; j < workers; j += nodes)
+						if(loads[j] < loads[local])
+							local = j;
+					if(loads[local] <= loads[worker] + tiles[i].cost)
+						worker = local;
+				}
+				loads[worker] += tiles[i].cost + 1;
+
+				new (&jobs[i]) TileJob { .raster = this, .tile = &tiles[i] };
+				this->pool.submit_job_for(worker, make_job(jobs[i], _tiles));
+			}
+			_tiles.wait();
+			if(this->dropped())
+			{
+				this->discard();
+				return;
+			}
+
+			_last_stats = RasterStats();
+			for(auto& stats : _stats)
+				_last_stats += stats;
+			this->discard();
+
+			_scheduler.schedule(this->pool.active());
+		}
+
+		/* Changes the number of active workers based on how long they spent
+		 * drawing since the last call, given how long drawing is allowed to
+		 * take, such that a light scene doesn't keep every thread busy. This
+		 * is meant to be called after every `flush()`. Workers get tiles
+		 * scheduled for them as of the next frame.
+		 *
+		 * Returns the number of workers that are now active. */
+		uint32_t adapt(std::chrono::nanoseconds budget)
+		{
+			uint32_t active = this->pool.adapt(budget);
+			_scheduler.schedule(active);
+			return active;
+		}
+
+		/* Pins the workers to the given NUMA nodes, and from then on hands
+		 * every tile to the workers of the node its rows belong to, as given
+		 * by `numa_topology::node_of_row()`. Targets should be placed on the
+		 * same nodes, by creating them with the same topology. Does nothing
+		 * on machines with a single node. */
+		void place(const numa_topology& topology)
+		{
+			this->wait();
+
+			numa_pin_pool(this->pool, topology);
+			_topology = topology;
+		}
+
+		/* Extent of the target, in pixels. */
+		uint32_t width()  const noexcept { return _width;  }
+		uint32_t height() const noexcept { return _height; }
+
+		/* Number of workers drawing for this raster, counting the parked
+		 * ones, and number of workers that are currently active. */
+		uint32_t threads() const noexcept { return this->pool.size(); }
+		uint32_t active_threads() const noexcept { return this->pool.active(); }
+
+		/* Fraction of the time the active workers spent busy, as measured by
+		 * the last call to `adapt()`. */
+		double utilization() const noexcept { return this->pool.utilization(); }
+
+		/* Pool the raster runs its jobs on, for work that should share its
+		 * workers, rather than start threads of its own. */
+		thread_pool& workers() noexcept { return this->pool; }
+
+		/* Starts capturing every frame drawn by `flush()` to the given stream,
+		 * or stops capturing, if it is null. Frames are captured after setup,
+		 * right before they get rasterized, so a capture holds exactly the
+		 * triangles that reached the bins, in projected space, along with
+		 * their bounds and the viewport, but none of the pipeline functions.
+		 *
+		 * The stream must outlive the capture. Capturing writes to the stream
+		 * from `flush()`, so it's bound to allocate. */
+		void capture(std::ostream *out) noexcept
+		{
+			_capture = out;
+		}
+
+		/* Loads the next frame from a capture straight into the bins, as if
+		 * all of its triangles had just gone through setup, replacing the
+		 * viewport with the one the frame was captured with. Calling `flush()`
+		 * afterwards draws the frame using the current `screen`, `slope` and
+		 * `painter` functions, none of the others get called.
+		 *
+		 * Returns false if the stream ends before the start of a frame. */
+		bool inject(std::istream& in) requires CapturablePoint<P>
+		{
+			this->wait();
+
+			auto fail = []()
+			{
+				auto what = u8"unexpected end of stream while reading frame capture"_fb;
+				throw std::runtime_error(what);
+			};
+
+			uint32_t magic, width, height, count;
+			if(!next_uint32_le(in, magic))
+				return false;
+			if(magic != CAPTURE_MAGIC)
+			{
+				auto what = u8"invalid frame capture tag"_fb;
+				throw std::runtime_error(what);
+			}
+			if(!next_uint32_le(in, width))  fail();
+			if(!next_uint32_le(in, height)) fail();
+			if(!next_uint32_le(in, count))  fail();
+
+			if(width != _width || height != _height)
+				this->viewport(width, height);
+
+			/* Spread the triangles over all of the bins, just like setup
+			 * would have done. */
+			uint32_t workers = this->pool.size();
+			for(uint32_t i = 0; i < count; ++i)
+			{
+				uint32_t bounds[4], visibility;
+				for(auto& bound : bounds)
+					if(!next_uint32_le(in, bound))
+						fail();
+				if(!next_uint32_le(in, visibility))
+					fail();
+				if(visibility > (uint32_t) Visibility::Spans)
+				{
+					auto what = u8"invalid frame capture visibility"_fb;
+					throw std::runtime_error(what);
+				}
+
+				Binned binned;
+				binned.left   = (int32_t) bounds[0];
+				binned.right  = (int32_t) bounds[1];
+				binned.top    = (int32_t) bounds[2];
+				binned.bottom = (int32_t) bounds[3];
+				binned.visibility = (Visibility) visibility;
+				binned.triangle.point0 = P::next_from_stream(in);
+				binned.triangle.point1 = P::next_from_stream(in);
+				binned.triangle.point2 = P::next_from_stream(in);
+
+				if(binned.left < 0 || binned.top < 0
+					|| binned.left > binned.right || binned.top > binned.bottom
+					|| binned.right  >= (int32_t) _width
+					|| binned.bottom >= (int32_t) _height)
+				{
+					auto what = u8"frame capture triangle out of bounds"_fb;
+					throw std::runtime_error(what);
+				}
+
+				uint32_t worker = i % workers;
+				_stats[worker].submitted++;
+				_stats[worker].rasterized++;
+				if(is_small(binned) && binned.visibility == Visibility::Depth)
+					_stats[worker].small++;
+				this->insert(binned, worker);
+			}
+
+			return true;
+		}
+
+		/* Counters of the last frame drawn by `flush()`. */
+		const RasterStats& stats() const
+		{
+			return _last_stats;
+		}
+
+		/* Counters the pipeline functions should report to. These belong to
+		 * the worker the calling thread is currently running a job for, so
+		 * they can be updated without any synchronization.
+		 *
+		 * Must only be called from inside of the pipeline functions. */
+		static RasterStats& local_stats()
+		{
+			return *_local_stats;
+		}
+
+		/* Draw the triangle the calling thread is setting up belongs to. See
+		 * `draw()`.
+		 *
+		 * Must only be called from inside of the functions used during
+		 * setup, that is, all of them but `screen`, `slope` and the
+		 * painters. */
+		static uint32_t local_draw()
+		{
+			return _local_draw;
+		}
+
+		/* Allocates uninitialized storage for the given number of objects,
+		 * which lasts until the end of the frame in flight, for state the
+		 * pipeline functions need for as long as the frame does. */
+		template<typename T>
+		T* frame_allocate(size_t count)
+		{
+			return _frame.allocate<T>(count);
 		}
 	};
 
@@ -674,8 +2438,12 @@ export namespace gfx
 	 *
 	 * This class holds a point buffer and an index buffer, both are used to 
 	 * build the triangles that will get submitted to the dispatch function of a
-	 * given renderer. */
-	template<typename P>
+	 * given renderer.
+	 *
+	 * Indices can be of any unsigned integer type. Meshes with no more than
+	 * 65536 vertices should prefer 16-bit indices, which halve the memory, and
+	 * the bandwidth during assembly, of the default 32-bit ones. */
+	template<typename P, std::unsigned_integral I = uint32_t>
 	class Mesh
 	{
 	protected:
@@ -683,13 +2451,17 @@ export namespace gfx
 		const std::vector<P>& _vertices;
 		
 		/* The indices used to assemble the vertex data into triangles. */
-		const std::vector<size_t>& _indices;
+		const std::vector<I>& _indices;
 
 		/* How the index data will be used to assemble triangle.s */
 		Primitive _primitive = Primitive::TriangleStrip;
 	public:
+		/* Index that ends the current strip in triangle strip mode, such that
+		 * the next one starts from scratch with the indices after it. */
+		static constexpr I RESTART = std::numeric_limits<I>::max();
+
 		/* Create a new mesh object with the given vertex and index data. */
-		Mesh(const std::vector<P>& vertices, const std::vector<size_t>& indices)
+		Mesh(const std::vector<P>& vertices, const std::vector<I>& indices)
 			: _vertices(vertices), _indices(indices)
 		{ }
 	
@@ -697,31 +2469,30 @@ export namespace gfx
 		 * with the given primitive assembler type. */
 		Mesh(
 			const std::vector<P>& vertices, 
-			const std::vector<size_t>& indices,
+			const std::vector<I>& indices,
 			Primitive primitive)
 			: _vertices(vertices), _indices(indices), _primitive(primitive)
 		{ }
 	protected:
-		/* Assembles the input in triangle list mode and actually performs all 
-		 * of the dispatch operations on the triangles. */
-		template<typename S>
-			requires Slope<S, P>
-		void dispatch_triangle_list(
-			Raster<P, S>& raster, 
-			std::vector<std::future<void>>& futures) const
+		/* Assembles the input in triangle list mode, handing every triangle
+		 * to the given function. */
+		template<typename F>
+		void assemble_triangle_list(F&& emit) const
 		{	
+			/* Meshes get drawn every frame, so only warn once in a while. */
+			static log_limiter trailing(std::chrono::seconds(1));
+			static log_limiter empty(std::chrono::seconds(1));
+
 			if(_indices.size() % 3 != 0)
-			{
-				std::cerr << "warning: mesh in triangle list mode will have ";
-				std::cerr << "its trailing " << _indices.size() % 3 << " ";
-				std::cerr << "indices ignored for not having a multiple of 3";
-				std::cerr << std::endl;
-			}
+				log_limited(trailing, log_level::warning,
+					"mesh in triangle list mode will have its trailing {} "
+					"indices ignored for not having a multiple of 3",
+					_indices.size() % 3);
 			if(_indices.size() / 3 == 0) 
 			{
 				/* No work to do. */
-				std::cerr << "warning: submitted mesh with no completable work";
-				std::cerr << std::endl;
+				log_limited(empty, log_level::warning,
+					"submitted mesh with no completable work");
 				return;
 			}
 
@@ -732,60 +2503,90 @@ export namespace gfx
 				p1 = _vertices[_indices[i + 1]];
 				p2 = _vertices[_indices[i + 2]];
 
-				raster.dispatch(p0, p1, p2, futures);
+				emit(p0, p1, p2);
 			}
 		}
 
-		/* Assembles the input in triangle strip mode and actually performs all
-		 * of the dispatch operations on the triangles. */
-		template<typename S>
-			requires Slope<S, P>
-		void dispatch_triangle_strip(
-			Raster<P, S>& raster, 
-			std::vector<std::future<void>>& futures) const
+		/* Assembles the input in triangle strip mode, handing every triangle
+		 * to the given function.
+		 *
+		 * Every other triangle in a strip has its first two points swapped,
+		 * such that all of them keep the winding of the first one. Strips are
+		 * separated by the `RESTART` index, and degenerate triangles, which
+		 * can also be used to join strips, are skipped. */
+		template<typename F>
+		void assemble_triangle_strip(F&& emit) const
 		{
-			if(_indices.size() / 3 == 0) 
+			static log_limiter empty(std::chrono::seconds(1));
+
+			if(_indices.size() < 3) 
 			{
 				/* No work to do. */
-				std::cerr << "warning: submitted mesh with no completable work";
-				std::cerr << std::endl;
+				log_limited(empty, log_level::warning,
+					"submitted mesh with no completable work");
 				return;
 			}
 
-			for(size_t i = 0; i + 2 < _indices.size(); ++i)
+			/* Number of indices in the current strip so far. */
+			size_t run = 0;
+			for(size_t i = 0; i < _indices.size(); ++i)
 			{
-				P p0, p1, p2;
-				p0 = _vertices[_indices[i + 0]];
-				p1 = _vertices[_indices[i + 1]];
-				p2 = _vertices[_indices[i + 2]];
-
-				raster.dispatch(p0, p1, p2, futures);
+				if(_indices[i] == RESTART)
+				{
+					run = 0;
+					continue;
+				}
+				if(++run < 3)
+					continue;
+
+				I i0 = _indices[i - 2];
+				I i1 = _indices[i - 1];
+				I i2 = _indices[i - 0];
+				if(run % 2 == 0)
+					std::swap(i0, i1);
+				if(i0 == i1 || i1 == i2 || i2 == i0)
+					continue;
+
+				emit(_vertices[i0], _vertices[i1], _vertices[i2]);
 			}
 		}
 
 	public:
-		/* Assemble the the geometry in this mesh into triangles and dispatch
-		 * them to the given raster, saving the futures of the operation in the
-		 * given vector. 
-		 *
-		 * This function does not block waiting for the render operation to
-		 * complete. If that is what you want, use `draw()` instead. */
-		template<typename S>
-			requires Slope<S, P>
-		void dispatch(
-			Raster<P, S>& raster, 
-			std::vector<std::future<void>>& futures) const
+		/* Assemble the geometry in this mesh into triangles, calling the given
+		 * function with the three points of each of them, for consumers other
+		 * than a raster, such as acceleration structures. */
+		template<typename F>
+		void assemble(F&& emit) const
 		{
 			switch(_primitive)
 			{
 			case Primitive::TriangleList: 
-				dispatch_triangle_list(raster, futures);
+				assemble_triangle_list(emit);
 				break;
 			case Primitive::TriangleStrip: 
-				dispatch_triangle_strip(raster, futures);
+				assemble_triangle_strip(emit);
 				break;
 			}
 		}
+
+		/* Assemble the the geometry in this mesh into triangles and dispatch
+		 * them to the given raster.
+		 *
+		 * This function does not block waiting for the render operation to
+		 * complete, nor does it flush the raster. If that is what you want, use
+		 * `draw()` instead. */
+		template<typename S>
+			requires Slope<S, P>
+		void dispatch(Raster<P, S>& raster) const
+		{
+			assemble([&raster](const P& p0, const P& p1, const P& p2)
+			{
+				raster.dispatch(p0, p1, p2);
+			});
+
+			/* Get the last, partially filled batch going. */
+			raster.submit();
+		}
 		
 		/* Assemble the the geometry in this mesh into triangles and dispatch
 		 * them to the given raster. This function blocks waiting for the mesh
@@ -794,11 +2595,8 @@ export namespace gfx
 			requires Slope<S, P>
 		void draw(Raster<P, S>& raster) const
 		{
-			std::vector<std::future<void>> commands;
-			dispatch(raster, commands);
-
-			for(size_t i = 0; i < commands.size(); ++i)
-				commands[i].wait();
+			dispatch(raster);
+			raster.flush();
 		}
 	};
 }
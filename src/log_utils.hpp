@@ -0,0 +1,366 @@
+#pragma once
+
+#include <atomic>               //std::atomic, std::memory_order_*
+#include <chrono>               //std::chrono::steady_clock, std::chrono::nanoseconds
+#include <cstddef>              //std::size_t
+#include <cstdint>              //std::uint32_t, std::uint64_t, std::int64_t
+#include <memory>               //std::unique_ptr, std::make_unique
+#include <mutex>                //std::mutex, std::lock_guard
+#include <ostream>              //std::ostream
+#include <type_traits>          //std::is_integral_v, std::is_floating_point_v, ...
+#include <vector>               //std::vector
+
+#include "thread_utils.hpp"     //thread_pool, wait_group, make_job
+
+/*
+ * Asynchronous logging.
+ *
+ * Every thread that logs gets a ring of records of its own, which only that thread
+ * writes to and only the drain reads from, so logging never takes a lock, never
+ * waits and never formats anything. A record holds the format string and the raw
+ * arguments; turning them into text is left to `log_drain`, which is meant to be
+ * called once in a while by a thread that isn't in a hurry, such as the timer thread
+ * of the thread pool. When a ring is full, records are dropped and counted instead.
+ *
+ * Format strings and string arguments are kept by pointer, so they must be string
+ * literals, or otherwise outlive the drain. Arguments get substituted for `{}` in
+ * the format string, in order.
+ *
+ * Getting a ring allocates, so threads get theirs up front, with `log_register_thread`
+ * or `log_register_pool`, and logging itself never allocates or locks, which lets it
+ * be done in the middle of a frame. Messages from threads that never registered are
+ * dropped and counted instead.
+ */
+
+enum class log_level : std::uint32_t {
+    info,
+    warning,
+    error
+};
+
+/**
+ * An argument of a log record, kept as is until the record is formatted.
+ */
+struct log_arg {
+    enum class kind : std::uint32_t { none, sint, uint, real, text };
+
+    kind type = kind::none;
+    union {
+        std::int64_t i;
+        std::uint64_t u;
+        double d;
+        const char* s;
+    };
+};
+
+template<typename T>
+log_arg log_make_arg(T value) noexcept {
+    using U = std::decay_t<T>;
+    log_arg a;
+    if constexpr(std::is_integral_v<U> && std::is_signed_v<U>) {
+        a.type = log_arg::kind::sint;
+        a.i = value;
+    } else if constexpr(std::is_integral_v<U>) {
+        a.type = log_arg::kind::uint;
+        a.u = value;
+    } else if constexpr(std::is_floating_point_v<U>) {
+        a.type = log_arg::kind::real;
+        a.d = value;
+    } else {
+        static_assert(std::is_convertible_v<U, const char*>, "log arguments must be numbers or static strings");
+        a.type = log_arg::kind::text;
+        a.s = value;
+    }
+    return a;
+}
+
+struct log_record {
+    static constexpr std::uint32_t MAX_ARGS = 6;
+
+    log_level level = log_level::info;
+    std::uint32_t count = 0;
+    const char* format = nullptr;
+    //number of records like this one a rate limiter held back before it
+    std::uint64_t suppressed = 0;
+    log_arg args[MAX_ARGS];
+};
+
+/**
+ * A single-producer, single-consumer ring of log records.
+ */
+class log_ring {
+public:
+    static constexpr std::size_t CAPACITY = 256;
+private:
+    log_record records[CAPACITY];
+    alignas(64) std::atomic<std::uint64_t> head { 0 };
+    alignas(64) std::atomic<std::uint64_t> tail { 0 };
+    std::atomic<std::uint64_t> dropped { 0 };
+
+    //prevent copying
+    log_ring(const log_ring&) = delete;
+    log_ring& operator=(const log_ring&) = delete;
+public:
+    //whether a live thread is writing to this ring
+    std::atomic<bool> owned { false };
+
+    explicit log_ring() {}
+
+    /**
+     * Adds a record to the ring, or drops it, if the ring is full. Must only be
+     * called from the thread that owns the ring.
+     */
+    void push(const log_record& r) noexcept {
+        const auto t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == CAPACITY) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        records[t % CAPACITY] = r;
+        tail.store(t + 1, std::memory_order_release);
+    }
+
+    /**
+     * Calls `f` with every record in the ring, oldest first, removing them. Returns
+     * the number of records dropped since the last call.
+     */
+    template<typename F>
+    std::uint64_t drain(F&& f) {
+        auto h = head.load(std::memory_order_relaxed);
+        const auto t = tail.load(std::memory_order_acquire);
+        for(; h != t; h++) {
+            f(records[h % CAPACITY]);
+        }
+        head.store(h, std::memory_order_release);
+        return dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    bool empty() const noexcept {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+namespace log_detail {
+    struct registry {
+        std::mutex lock;
+        std::vector<std::unique_ptr<log_ring>> rings;
+    };
+
+    inline registry& get_registry() {
+        static registry r;
+        return r;
+    }
+
+    //the ring of the current thread, if it registered, which is all that logging
+    //looks at; unlike the owner below, it needs no destructor, so touching it for
+    //the first time doesn't allocate either
+    inline thread_local log_ring* current = nullptr;
+
+    //number of messages dropped because their thread never registered
+    inline std::atomic<std::uint64_t> unregistered { 0 };
+
+    //hands the ring of a thread back once the thread exits, so that the next thread
+    //to register can take it over, rather than allocating a new one
+    struct ring_owner {
+        log_ring* ring = nullptr;
+
+        ~ring_owner() {
+            if(ring) {
+                current = nullptr;
+                ring->owned.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    //allocates, but only the first time a thread registers
+    inline log_ring& local_ring() {
+        thread_local ring_owner owner;
+        if(!owner.ring) {
+            auto& r = get_registry();
+            std::lock_guard<std::mutex> l(r.lock);
+            for(auto& ring : r.rings) {
+                if(!ring->owned.load(std::memory_order_acquire) && ring->empty()) {
+                    owner.ring = ring.get();
+                    break;
+                }
+            }
+            if(!owner.ring) {
+                r.rings.push_back(std::make_unique<log_ring>());
+                owner.ring = r.rings.back().get();
+            }
+            owner.ring->owned.store(true, std::memory_order_release);
+        }
+        current = owner.ring;
+        return *owner.ring;
+    }
+
+    template<typename... Args>
+    void write(log_level level, std::uint64_t suppressed, const char* format, Args... args) noexcept {
+        static_assert(sizeof...(Args) <= log_record::MAX_ARGS, "too many log arguments");
+        log_record r;
+        r.level = level;
+        r.count = sizeof...(Args);
+        r.format = format;
+        r.suppressed = suppressed;
+        std::uint32_t i = 0;
+        ((r.args[i++] = log_make_arg(args)), ...);
+        (void)i;
+        if(!current) {
+            unregistered.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        current->push(r);
+    }
+
+    inline void print(std::ostream& out, const log_arg& a) {
+        switch(a.type) {
+            case log_arg::kind::sint: out << a.i; break;
+            case log_arg::kind::uint: out << a.u; break;
+            case log_arg::kind::real: out << a.d; break;
+            case log_arg::kind::text: out << (a.s ? a.s : "(null)"); break;
+            default: break;
+        }
+    }
+
+    inline void format(std::ostream& out, const log_record& r) {
+        switch(r.level) {
+            case log_level::warning: out << "warning: "; break;
+            case log_level::error:   out << "error: ";   break;
+            default: break;
+        }
+        std::uint32_t next = 0;
+        for(auto c = r.format; *c; c++) {
+            if(c[0] == '{' && c[1] == '}' && next < r.count) {
+                print(out, r.args[next++]);
+                c++;
+            } else {
+                out << *c;
+            }
+        }
+        if(r.suppressed) {
+            out << " (" << r.suppressed << " more like this were suppressed)";
+        }
+        out << '\n';
+    }
+}
+
+/**
+ * Gives the calling thread a ring to log into. Must be called before the thread
+ * logs anything, and may be called any number of times.
+ */
+inline void log_register_thread() {
+    log_detail::local_ring();
+}
+
+/**
+ * Gives every worker of a pool, parked or not, a ring to log into, so that jobs
+ * can log no matter which worker they run on.
+ */
+inline void log_register_pool(thread_pool& pool) {
+    wait_group group;
+    auto reg = [&](std::uint32_t) {
+        log_register_thread();
+        group.done();
+    };
+    group.add(pool.size());
+    for(std::uint32_t i = 0; i < pool.size(); i++) {
+        pool.submit_job_for(i, make_job(reg));
+    }
+    group.wait();
+}
+
+/**
+ * Logs a message, without blocking or allocating. See the top of this file for the
+ * rules the format string and the arguments follow.
+ */
+template<typename... Args>
+void log_write(log_level level, const char* format, Args... args) noexcept {
+    log_detail::write(level, 0, format, args...);
+}
+
+template<typename... Args>
+void log_info(const char* format, Args... args) noexcept {
+    log_write(log_level::info, format, args...);
+}
+
+template<typename... Args>
+void log_warning(const char* format, Args... args) noexcept {
+    log_write(log_level::warning, format, args...);
+}
+
+template<typename... Args>
+void log_error(const char* format, Args... args) noexcept {
+    log_write(log_level::error, format, args...);
+}
+
+/**
+ * Lets through at most one message per interval, counting the ones it holds back.
+ * Meant to be kept next to a message that could otherwise be logged many times a
+ * frame, usually as a static.
+ */
+class log_limiter {
+private:
+    const std::uint64_t interval;
+    std::atomic<std::uint64_t> next { 0 };
+    std::atomic<std::uint64_t> suppressed { 0 };
+
+    //prevent copying
+    log_limiter(const log_limiter&) = delete;
+    log_limiter& operator=(const log_limiter&) = delete;
+public:
+    explicit log_limiter(std::chrono::nanoseconds interval): interval(interval.count()) {}
+
+    /**
+     * Returns whether a message may be logged now, along with the number of messages
+     * held back since the last one that was.
+     */
+    bool allow(std::uint64_t& missed) noexcept {
+        const auto now = (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto at = next.load(std::memory_order_relaxed);
+        if(now < at || !next.compare_exchange_strong(at, now + interval, std::memory_order_relaxed)) {
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        missed = suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+/**
+ * Logs a message, unless the limiter held it back.
+ */
+template<typename... Args>
+void log_limited(log_limiter& limiter, log_level level, const char* format, Args... args) noexcept {
+    std::uint64_t missed = 0;
+    if(limiter.allow(missed)) {
+        log_detail::write(level, missed, format, args...);
+    }
+}
+
+/**
+ * Formats and writes out every message logged so far, from every thread. Returns the
+ * number of messages written. Only one thread may drain at a time.
+ */
+inline std::size_t log_drain(std::ostream& out) {
+    auto& r = log_detail::get_registry();
+    std::lock_guard<std::mutex> l(r.lock);
+
+    std::size_t count = 0;
+    if(const auto lost = log_detail::unregistered.exchange(0, std::memory_order_relaxed)) {
+        out << "warning: dropped " << lost << " log messages from threads that never registered\n";
+    }
+    for(auto& ring : r.rings) {
+        const auto dropped = ring->drain([&](const log_record& record) {
+            log_detail::format(out, record);
+            count++;
+        });
+        if(dropped) {
+            out << "warning: dropped " << dropped << " log messages, the ring was full\n";
+        }
+    }
+    if(count) {
+        out.flush();
+    }
+    return count;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>              //std::size_t
+#include <cstdint>              //std::uint8_t
+#include <cstring>              //std::memcpy
+
+/*
+ * Decompression of LZ4 blocks, as written by the reference implementation of LZ4,
+ * or by `tools/map`.
+ *
+ * A block is a series of sequences, each made up of a token, a run of literals
+ * copied to the output as is, and a match, which copies earlier output from a given
+ * distance back. The high nibble of the token is the number of literals and the low
+ * one the length of the match, minus its minimum of 4. A nibble of 15 is followed by
+ * bytes adding to it, up to and including the first byte that isn't 255. The offset
+ * of the match is a little endian 16 bit number between the literals and the rest of
+ * the length of the match. The last sequence of a block only has literals.
+ *
+ * Only blocks are handled here, with no frames or checksums around them, so the size
+ * of the decompressed data has to be known beforehand.
+ */
+
+namespace lz4_detail {
+    constexpr std::size_t MIN_MATCH = 4;
+
+    //reads the rest of a length whose nibble was 15, returning false if the input
+    //runs out first
+    inline bool read_length(const std::uint8_t*& in, const std::uint8_t* end, std::size_t& length) noexcept {
+        std::uint8_t byte;
+        do {
+            if(in == end) {
+                return false;
+            }
+            byte = *in++;
+            length += byte;
+        } while(byte == 255);
+        return true;
+    }
+}
+
+/**
+ * Returns the largest size a block of `src_size` bytes can decompress to. No byte of
+ * a block stands for more than 255 bytes of output, which is what every byte after a
+ * length nibble of 15 can add to it, so sizes any larger than this can be rejected
+ * before making room for them.
+ */
+constexpr std::size_t lz4_max_decompressed_size(std::size_t src_size) noexcept {
+    return src_size * 255;
+}
+
+/**
+ * Decompresses an LZ4 block into `dst`, which has room for exactly the decompressed
+ * data. Returns whether the block was well formed and decompressed to exactly
+ * `dst_size` bytes. Malformed blocks never get read or written out of bounds.
+ */
+inline bool lz4_decompress(const std::uint8_t* src, std::size_t src_size, std::uint8_t* dst, std::size_t dst_size) noexcept {
+    const std::uint8_t* in = src;
+    const std::uint8_t* const in_end = src + src_size;
+    std::uint8_t* out = dst;
+    std::uint8_t* const out_end = dst + dst_size;
+
+    while(in < in_end) {
+        const auto token = *in++;
+
+        std::size_t literals = token >> 4;
+        if(literals == 15 && !lz4_detail::read_length(in, in_end, literals)) {
+            return false;
+        }
+        if(literals > (std::size_t)(in_end - in) || literals > (std::size_t)(out_end - out)) {
+            return false;
+        }
+        if(literals) {
+            std::memcpy(out, in, literals);
+            in += literals;
+            out += literals;
+        }
+
+        //the last sequence ends right after its literals
+        if(in == in_end) {
+            break;
+        }
+
+        if(in_end - in < 2) {
+            return false;
+        }
+        const std::size_t offset = (std::size_t)in[0] | (std::size_t)in[1] << 8;
+        in += 2;
+        if(offset == 0 || offset > (std::size_t)(out - dst)) {
+            return false;
+        }
+
+        std::size_t length = token & 15;
+        if(length == 15 && !lz4_detail::read_length(in, in_end, length)) {
+            return false;
+        }
+        length += lz4_detail::MIN_MATCH;
+        if(length > (std::size_t)(out_end - out)) {
+            return false;
+        }
+
+        const std::uint8_t* match = out - offset;
+        if(offset >= length) {
+            std::memcpy(out, match, length);
+            out += length;
+        } else {
+            //the match overlaps what it writes, repeating the last `offset` bytes, so
+            //copy as many whole repetitions at a time as have been written so far
+            std::size_t copied = 0;
+            std::size_t step = offset;
+            while(copied < length) {
+                const auto n = length - copied < step ? length - copied : step;
+                std::memcpy(out + copied, match, n);
+                copied += n;
+                step += n;
+            }
+            out += length;
+        }
+    }
+    return out == out_end;
+}
@@ -1,8 +1,10 @@
 
 #include <SFML/Window.hpp>		/* For Window functionality.	*/
 #include <SFML/Graphics.hpp>	/* For showing what we draw.	*/
+#include "perf_utils.hpp"		/* For per-stage counters.		*/
 
 import <iostream>;
+import <fstream>;	/* For frame captures.		*/
 import gfx;		/* For graphics functions.	*/
 import game;	/* For the game.			*/
 import str;		/* Haha UTF-8 go brr.		*/
@@ -32,6 +34,9 @@ int main(void)
 	using Duration = std::chrono::duration<double, std::ratio<1>>;
 	auto last_time = Clock::now();
 
+	/* Frames get captured to this file while F2 is toggled on. */
+	std::ofstream capture;
+
 	/* Run the game. */
 	while(!game.exit())
 	{
@@ -54,6 +59,38 @@ int main(void)
 				case sf::Keyboard::Key::S: game.controller().backward(true); break;
 				case sf::Keyboard::Key::D: game.controller().right(true);    break;
 				case sf::Keyboard::Key::C: game.controller().crouch(true);   break;
+				case sf::Keyboard::Key::F1:
+					game.controller().overlay(!game.controller().overlay());
+					break;
+				case sf::Keyboard::Key::F3:
+					game.controller().spans(!game.controller().spans());
+					break;
+				case sf::Keyboard::Key::F4:
+					game.controller().trace(!game.controller().trace());
+					break;
+				case sf::Keyboard::Key::F5:
+					game.controller().shadows(!game.controller().shadows());
+					break;
+				case sf::Keyboard::Key::F2:
+					if(capture.is_open())
+					{
+						game.capture(nullptr);
+						capture.close();
+						std::cerr << "stopped capturing frames" << std::endl;
+					}
+					else
+					{
+						capture.open("capture.qof", std::ios_base::out | std::ios_base::binary);
+						if(!capture)
+						{
+							std::cerr << "could not open capture.qof" << std::endl;
+							capture.clear();
+							break;
+						}
+						game.capture(&capture);
+						std::cerr << "capturing frames to capture.qof" << std::endl;
+					}
+					break;
 				default: break;
 				}
 			else if(event.type == sf::Event::KeyReleased)
@@ -99,18 +136,22 @@ int main(void)
 
 		game.iterate(delta);
 
-		sf::Image image;
-		image.create(WIDTH, HEIGHT, (sf::Uint8*) game.get_screen().data());
+		{
+			perf_scope scope(perf_stage::present);
 
-		sf::Texture texture;
-		texture.loadFromImage(image);
-		
-		sf::Sprite sprite(texture);
-		sprite.setOrigin(0, 0);
+			sf::Image image;
+			image.create(WIDTH, HEIGHT, (sf::Uint8*) game.get_screen().data());
 
-		window.clear();
-		window.draw(sprite);
-		window.display();
+			sf::Texture texture;
+			texture.loadFromImage(image);
+			
+			sf::Sprite sprite(texture);
+			sprite.setOrigin(0, 0);
+
+			window.clear();
+			window.draw(sprite);
+			window.display();
+		}
 	}
 end:
 
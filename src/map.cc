@@ -2,6 +2,11 @@
 module;
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
+#include "numa_utils.hpp"	/* For texture placement. */
+#include "log_utils.hpp"	/* For loading progress. */
+#include "pack_utils.hpp"	/* For shared textures. */
+#include "lz4_utils.hpp"	/* For compressed models. */
+#include "thread_utils.hpp"	/* For loading models in parallel. */
 
 /* Test for the endianness of the host machine. */
 bool LITTLE_ENDIAN_HOST()
@@ -18,6 +23,18 @@ import <iostream>;	/* For stream functionality.	*/
 import <vector>;	/* For vectors.					*/
 import <sstream>;	/* AAAAAAAAAAAAAAAAAAAAAAAAAAA.	*/
 import <concepts>;	/* For standard concepts.		*/
+import <optional>;	/* For cell lookups.			*/
+import <algorithm>;	/* For std::reverse.			*/
+import <array>;		/* For triangle surfaces.		*/
+import <cmath>;		/* For ray intersections.		*/
+import <limits>;	/* For ray ranges.				*/
+import <memory>;	/* For shared maps.				*/
+import <mutex>;		/* For the map cache.			*/
+import <map>;		/* For the map cache.			*/
+import <string>;	/* For map paths.				*/
+import <fstream>;	/* For map files.				*/
+import <atomic>;	/* For handing out sections.	*/
+import <exception>;	/* For failures on workers.		*/
 import gfx;			/* For Plane and Sampler.		*/
 import str;			/* For UTF-8 strings.			*/
 
@@ -72,6 +89,53 @@ export namespace map
 		return data;
 	}
 
+	/* Load the given number of bytes from a stream into a string.
+	 * The string only grows as the bytes come in, so a size read from a
+	 * corrupt stream can't make it take any more memory than the stream
+	 * actually holds. */
+	std::istream& next_bytes(std::istream& data, std::string& target, uint32_t size)
+	{
+		constexpr size_t CHUNK = 1 << 20;
+
+		target.clear();
+		while(target.size() < size && data)
+		{
+			size_t at = target.size();
+			size_t count = std::min<size_t>(size - at, CHUNK);
+			target.resize(at + count);
+			data.read(target.data() + at, count);
+		}
+		return data;
+	}
+
+	/* Write a 32-bit floating point value to a stream.
+	 * The floating point output is written as little endian. */
+	std::ostream& write_float32_le(std::ostream& data, float value)
+	{
+		static_assert(sizeof(float) == 4);
+
+		char buf[sizeof(float)];
+		std::memcpy((void*) buf, (const void*) &value, sizeof(float));
+
+		if(!LITTLE_ENDIAN_HOST())
+			std::reverse(buf, buf + sizeof(float));
+		return data.write(buf, sizeof(float));
+	}
+
+	/* Write a 32-bit unsigned integer value to a stream.
+	 * The integer output is written as little endian. */
+	std::ostream& write_uint32_le(std::ostream& data, uint32_t value)
+	{
+		static_assert(sizeof(uint32_t) == 4);
+
+		char buf[sizeof(uint32_t)];
+		std::memcpy((void*) buf, (const void*) &value, sizeof(uint32_t));
+
+		if(!LITTLE_ENDIAN_HOST())
+			std::reverse(buf, buf + sizeof(uint32_t));
+		return data.write(buf, sizeof(uint32_t));
+	}
+
 	/* Load a texture from a stream object.
 	 * The data in the texture is expected to be laid out in the following way:
 	 *     |--------|---------------|-----------------------------------|
@@ -99,8 +163,7 @@ export namespace map
 		if(!next_uint32_le(data, width))  fail();
 		if(!next_uint32_le(data, height)) fail();
 
-		std::cerr << u8"> texture ("_fb << width << u8", "_fb;
-		std::cerr << height << u8")"_fb << std::endl;
+		log_info("> texture ({}, {})", width, height);
 
 		gfx::Plane<gfx::PixelRgba32> plane(width, height);
 		for(uint32_t i = 0; i < height; ++i)
@@ -117,6 +180,39 @@ export namespace map
 
 		return plane;
 	}	
+
+	/* Loads a texture from a texture pack, given the hash of its contents in
+	 * the stream. The plane uses the pixels in the pack in place, so the pack
+	 * must outlive it, and the plane must never be written to, as the pack is
+	 * mapped read-only. */
+	gfx::Plane<gfx::PixelRgba32> find_texture_rgba32(
+		std::istream& data,
+		const texture_pack& pack)
+	{
+		uint8_t hash[texture_pack::HASH_SIZE];
+		data.read((char*) hash, sizeof(hash));
+		if(!data)
+		{
+			std::string what = u8"unexpected end of stream while reading \
+				a texture hash"_fb;
+			throw std::runtime_error(what);
+		}
+
+		texture_pack::texture texture;
+		if(!pack.find(hash, texture))
+		{
+			std::string what = u8"texture missing from the texture pack"_fb;
+			throw std::runtime_error(what);
+		}
+
+		log_info("> packed texture ({}, {})", texture.width, texture.height);
+
+		auto pixels = reinterpret_cast<const gfx::PixelRgba32*>(texture.pixels);
+		return gfx::Plane<gfx::PixelRgba32>(
+			texture.width,
+			texture.height,
+			const_cast<gfx::PixelRgba32*>(pixels));
+	}
 	
 	/* Points that can be loaded from an input stream. */
 	template<typename T>
@@ -135,31 +231,105 @@ export namespace map
 	protected:
 		uint32_t _mode;
 
+		/* Whether this model never moves. */
+		bool _static;
+
 		std::vector<P> _points;
-		std::vector<size_t> _indices;
+
+		/* Indices of the model, as 16-bit integers whenever the model has
+		 * few enough points, and as 32-bit integers otherwise. Only one of
+		 * these is ever in use. */
+		std::vector<uint16_t> _narrow;
+		std::vector<uint32_t> _wide;
 
 		glm::mat4 _transform;
 	public:
+		/* Bits of the mode word holding the primitive assembly mode. */
+		static constexpr uint32_t MODE_PRIMITIVE = 0xff;
+
+		/* Bit of the mode word set for models that may move, and thus can't
+		 * be baked into world space. */
+		static constexpr uint32_t MODE_DYNAMIC = 0x100;
+
+		/* Index that separates the strips of models in strip mode. */
+		static constexpr uint32_t UINT32_RESTART = gfx::Mesh<P, uint32_t>::RESTART;
+
+		/* Number of bytes in front of the points of a model in a stream. */
+		static constexpr uint64_t HEADER_SIZE = 48;
+
+		/* Size given to `load()` for models whose size isn't known. */
+		static constexpr uint64_t UNKNOWN_SIZE = UINT64_MAX;
+
+	protected:
 		/* This type can be treated as a Mesh with no loss of information. */
-		gfx::Mesh<P> mesh() const
+		template<typename I>
+		gfx::Mesh<P, I> mesh(const std::vector<I>& indices) const
 		{
-			switch(_mode)
+			switch(_mode & MODE_PRIMITIVE)
 			{
 			case 0:
-				return gfx::Mesh<P>(_points, _indices, gfx::Primitive::TriangleList);
+				return gfx::Mesh<P, I>(_points, indices, gfx::Primitive::TriangleList);
 			case 1:
-				return gfx::Mesh<P>(_points, _indices, gfx::Primitive::TriangleStrip);
+				return gfx::Mesh<P, I>(_points, indices, gfx::Primitive::TriangleStrip);
 			}
 
 			std::string what = u8"invalid mesh mode"_fb;
 			throw std::runtime_error(what);
 		}
+	public:
+		/* Assemble this model into triangles and dispatch them to the given
+		 * raster. Works just like `gfx::Mesh::dispatch()`. */
+		template<typename S>
+		void dispatch(gfx::Raster<P, S>& raster) const
+		{
+			if(_wide.empty())
+				mesh(_narrow).dispatch(raster);
+			else
+				mesh(_wide).dispatch(raster);
+		}
+
+		/* Assemble this model into triangles, in model space, and hand them
+		 * to the given function. Works just like `gfx::Mesh::assemble()`. */
+		template<typename F>
+		void assemble(F&& emit) const
+		{
+			if(_wide.empty())
+				mesh(_narrow).assemble(emit);
+			else
+				mesh(_wide).assemble(emit);
+		}
 
-		/* Transformation matrix from model space to world space. */
+		/* Assemble this model into triangles and draw them to the given
+		 * raster. Works just like `gfx::Mesh::draw()`. */
+		template<typename S>
+		void draw(gfx::Raster<P, S>& raster) const
+		{
+			dispatch(raster);
+			raster.flush();
+		}
+
+		/* Transformation matrix from model space to world space. Always the
+		 * identity for static models, which are already in world space. */
 		glm::mat4 transformation() const
 		{
 			return _transform;
 		}
+
+		/* Whether this model never moves, in which case its points have been
+		 * transformed to world space when it got loaded. */
+		bool is_static() const
+		{
+			return _static;
+		}
+	protected:
+		/* Transforms all of the points of this model to world space, such
+		 * that they don't have to be transformed every time it's drawn. */
+		void bake()
+		{
+			for(auto& point : _points)
+				point.position = _transform * point.position;
+			_transform = glm::mat4(1.0);
+		}
 	public:
 
 		/* Loads a model from a stream object.
@@ -169,6 +339,7 @@ export namespace map
 		 *     |--------|---------------|-------------------------------------|
 		 *     | 0      | uint32_t      | Primitive assembly mode:            |
 		 *     |        |               | 0 = TriangleList 1 = TriangleStrip  | 
+		 *     |        |               | ORed with 0x100 for dynamic models. |
 		 *     | 4      | uint32_t      | Number of points in the model.      |
 		 *     | 8      | uint32_t      | Number of indices in the model.     |
 		 *     | 12     | float         | X value for the world translation.  |
@@ -181,11 +352,16 @@ export namespace map
 		 *     | 40     | float         | Yaw   value for the world rotation. |
 		 *     | 44     | float         | Roll  value for the world rotation. |
 		 *     | 48     | P[]           | Packed template-loaded points.      |
-		 *     | ..     | uint32_t[]    | Packed indices.                     |
+		 *     | ..     | uint32_t[]    | Packed indices. In strip mode, the  |
+		 *     |        |               | strips are separated by 0xffffffff. |
 		 *     |--------|---------------|-------------------------------------|
 		 * The data from the stream will be copied and put into a new Model object,
-		 * with the exact same parameters as the ones given in the data stream. */
-		static Model<P> load(std::istream& data)
+		 * with the exact same parameters as the ones given in the data stream.
+		 * If the number of bytes the model takes up is known, the numbers of
+		 * points and indices are checked against it before making room for
+		 * them. Otherwise they come straight from the stream, so the model
+		 * grows as they are read instead. */
+		static Model<P> load(std::istream& data, uint64_t size = UNKNOWN_SIZE)
 		{
 			Model<P> model;
 			uint32_t points, indices;
@@ -218,21 +394,53 @@ export namespace map
 			model._transform = glm::rotate(yaw,   glm::vec3(0.0, 1.0, 0.0));
 			model._transform = glm::rotate(roll,  glm::vec3(0.0, 0.0, 1.0));
 
-			std::cerr << u8"> model "_fb << points << u8"p "_fb << indices;
-			std::cerr << u8"i"_fb << std::endl;
+			log_info("> model {}p {}i", points, indices);
+
+			if(size != UNKNOWN_SIZE)
+			{
+				if(HEADER_SIZE + (uint64_t) points * P::STREAM_SIZE
+					+ (uint64_t) indices * sizeof(uint32_t) > size)
+				{
+					std::string what = u8"model has more points and indices \
+						than fit in it"_fb;
+					throw std::runtime_error(what);
+				}
+				model._points.reserve(points);
+				model._wide.reserve(indices);
+			}
 
-			model._points.reserve(points);
 			for(uint32_t i = 0; i < points; ++i)
 				model._points.push_back(P::next_from_stream(data));
 
-			model._indices.reserve(indices);
 			for(uint32_t i = 0; i < indices; ++i)
 			{
 				uint32_t index;
 				if(!next_uint32_le(data, index)) fail();
-				model._indices.push_back(index);
+				if(index >= points && index != UINT32_RESTART)
+				{
+					std::string what = u8"model index out of range"_fb;
+					throw std::runtime_error(what);
+				}
+				model._wide.push_back(index);
+			}
+
+			/* Use the narrowest type that fits every index, leaving room for
+			 * the restart index. */
+			if(points <= 0xffff)
+			{
+				model._narrow.reserve(model._wide.size());
+				for(auto index : model._wide)
+					model._narrow.push_back(index == UINT32_RESTART
+						? gfx::Mesh<P, uint16_t>::RESTART
+						: (uint16_t) index);
+				model._wide = std::vector<uint32_t>();
 			}
 
+			/* Models that never move only need to be transformed once. */
+			model._static = !(model._mode & MODE_DYNAMIC);
+			if(model._static)
+				model.bake();
+
 			return model;
 		}
 	};
@@ -252,6 +460,9 @@ export namespace map
 		/* Position of this point in model space. */
 		glm::vec4 position;
 
+		/* Number of bytes a point takes up in a stream. */
+		static constexpr uint64_t STREAM_SIZE = 40;
+
 		/* Loads a point from an input stream. */
 		static Point next_from_stream(std::istream& data)
 		{
@@ -284,6 +495,22 @@ export namespace map
 
 			return p;
 		}
+
+		/* Writes this point to an output stream, in the same format it gets
+		 * loaded in by `next_from_stream()`. */
+		void write_to_stream(std::ostream& data) const
+		{
+			write_uint32_le(data, texture_index);
+			write_float32_le(data, sampler.x);
+			write_float32_le(data, sampler.y);
+			write_float32_le(data, color.x);
+			write_float32_le(data, color.y);
+			write_float32_le(data, color.z);
+			write_float32_le(data, position.x);
+			write_float32_le(data, position.y);
+			write_float32_le(data, position.z);
+			write_float32_le(data, position.w);
+		}
 	};
 
 	/* Slope between two points. */
@@ -311,6 +538,537 @@ export namespace map
 		Point at(float x) { return at((double) x); }
 	};
 
+	/* A convex region of space, such as a room, along with the models inside
+	 * of it and the portals leading out of it. */
+	struct Cell
+	{
+		/* Bounds of the cell in world space. */
+		glm::vec3 min;
+		glm::vec3 max;
+
+		/* Indices of the model slices inside of this cell. */
+		std::vector<uint32_t> models;
+
+		/* Indices of all of the portals that touch this cell. */
+		std::vector<uint32_t> portals;
+
+		/* Whether the given point in world space lies inside of this cell. */
+		bool contains(glm::vec3 point) const
+		{
+			return point.x >= min.x && point.x <= max.x
+				&& point.y >= min.y && point.y <= max.y
+				&& point.z >= min.z && point.z <= max.z;
+		}
+	};
+
+	/* An opening between two cells, through which one can be seen from the
+	 * other. */
+	struct Portal
+	{
+		/* Indices of the cells on either side of the portal. */
+		uint32_t front;
+		uint32_t back;
+
+		/* Outline of the opening, in world space. */
+		std::vector<glm::vec3> points;
+
+		/* Given the index of the cell on one side, returns the index of the
+		 * cell on the other side of the portal. */
+		uint32_t other(uint32_t cell) const
+		{
+			return cell == front ? back : front;
+		}
+	};
+
+	/* Number of rays traced together by a bounding volume hierarchy. */
+	constexpr uint32_t PACKET = 8;
+
+	/* A packet of rays traced together.
+	 *
+	 * Rays are kept as arrays of each of their components, rather than as an
+	 * array of rays, such that every test runs over all of the rays in a loop
+	 * without branches, which the compiler turns into vector instructions. */
+	struct RayPacket
+	{
+		/* Origins and directions of the rays, and the reciprocals of the
+		 * directions, for the slab tests against bounding boxes. */
+		float ox[PACKET], oy[PACKET], oz[PACKET];
+		float dx[PACKET], dy[PACKET], dz[PACKET];
+		float ix[PACKET], iy[PACKET], iz[PACKET];
+
+		/* Range along every ray in which hits count. The far end gets pulled
+		 * in to every hit found. Rays whose range is empty are ignored. */
+		float near[PACKET];
+		float far[PACKET];
+
+		/* Index of the triangle every ray hit, or `NO_HIT`, along with the
+		 * barycentric coordinates of the hit in that triangle. */
+		uint32_t hit[PACKET];
+		float u[PACKET];
+		float v[PACKET];
+
+		static constexpr uint32_t NO_HIT = 0xffffffff;
+
+		/* Set up the ray in the given lane. */
+		void set(uint32_t i, glm::vec3 origin, glm::vec3 direction, float from, float to)
+		{
+			ox[i] = origin.x;
+			oy[i] = origin.y;
+			oz[i] = origin.z;
+			dx[i] = direction.x;
+			dy[i] = direction.y;
+			dz[i] = direction.z;
+			ix[i] = 1.0f / direction.x;
+			iy[i] = 1.0f / direction.y;
+			iz[i] = 1.0f / direction.z;
+			near[i] = from;
+			far[i]  = to;
+			hit[i]  = NO_HIT;
+			u[i] = 0.0f;
+			v[i] = 0.0f;
+		}
+
+		/* Leave the ray in the given lane out of the trace. */
+		void disable(uint32_t i)
+		{
+			set(i, glm::vec3(0.0f), glm::vec3(1.0f), 1.0f, 0.0f);
+		}
+	};
+
+	/* A node of a bounding volume hierarchy. */
+	struct BvhNode
+	{
+		glm::vec3 min;
+
+		/* Index of the first triangle of leaves, and of the second child of
+		 * inner nodes, whose first child always comes right after them. */
+		uint32_t index;
+
+		glm::vec3 max;
+
+		/* Number of triangles of leaves, zero for inner nodes. */
+		uint16_t count;
+
+		/* Axis inner nodes are split along. */
+		uint16_t axis;
+	};
+
+	/* A triangle of a bounding volume hierarchy, as one of its corners and
+	 * the edges leaving it, which is what the intersection test wants. */
+	struct BvhTriangle
+	{
+		glm::vec3 origin;
+		glm::vec3 edge1;
+		glm::vec3 edge2;
+	};
+
+	/* Bounding volume hierarchy over all of the triangles of a map, in world
+	 * space, for tracing rays through it.
+	 *
+	 * The hierarchy is built with the surface area heuristic, over binned
+	 * centroids, and traced a packet of rays at a time. Models that may move
+	 * are put in at the place they are in when the hierarchy gets built, so
+	 * it has to be rebuilt once they move. */
+	class Bvh
+	{
+	protected:
+		std::vector<BvhNode> _nodes;
+		std::vector<BvhTriangle> _triangles;
+
+		/* Points of every triangle, in world space, in the same order as the
+		 * triangles, for shading the hits. */
+		std::vector<std::array<Point, 3>> _surfaces;
+
+		/* Number of bins the centroids get sorted into when looking for the
+		 * best split. */
+		static constexpr uint32_t BINS = 12;
+
+		/* Number of triangles below which nodes always become leaves. */
+		static constexpr uint32_t LEAF_SIZE = 4;
+
+		/* Depth past which nodes get split in half, rather than where the
+		 * heuristic says, so that traversal stacks have a bound. */
+		static constexpr uint32_t SAH_DEPTH = 64;
+
+		/* Deepest a hierarchy can ever get. Splitting in half from
+		 * `SAH_DEPTH` on takes no more than another 32 levels. */
+		static constexpr uint32_t MAX_DEPTH = SAH_DEPTH + 32;
+
+		/* Bounding box of a set of triangles. */
+		struct Bounds
+		{
+			glm::vec3 min = glm::vec3(+std::numeric_limits<float>::infinity());
+			glm::vec3 max = glm::vec3(-std::numeric_limits<float>::infinity());
+
+			void grow(glm::vec3 p)
+			{
+				min = glm::min(min, p);
+				max = glm::max(max, p);
+			}
+
+			void grow(const Bounds& other)
+			{
+				min = glm::min(min, other.min);
+				max = glm::max(max, other.max);
+			}
+
+			float area() const
+			{
+				glm::vec3 e = max - min;
+				if(e.x < 0.0f)
+					return 0.0f;
+				return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+			}
+		};
+
+		/* Scratch state of a build, with the bounds and centroid of every
+		 * triangle, and the order they end up in. */
+		struct Build
+		{
+			std::vector<Bounds> bounds;
+			std::vector<glm::vec3> centroids;
+			std::vector<uint32_t> order;
+		};
+
+		/* Build the subtree over the triangles in [first, first + count) of
+		 * the build order, returning the index of its root. */
+		uint32_t build(Build& b, uint32_t first, uint32_t count, uint32_t depth)
+		{
+			Bounds bounds, centroids;
+			for(uint32_t i = first; i < first + count; ++i)
+			{
+				bounds.grow(b.bounds[b.order[i]]);
+				centroids.grow(b.centroids[b.order[i]]);
+			}
+
+			uint32_t index = (uint32_t) _nodes.size();
+			_nodes.push_back(BvhNode { });
+			_nodes[index].min = bounds.min;
+			_nodes[index].max = bounds.max;
+
+			auto leaf = [&]()
+			{
+				_nodes[index].index = first;
+				_nodes[index].count = (uint16_t) count;
+				_nodes[index].axis  = 0;
+				return index;
+			};
+
+			glm::vec3 extent = centroids.max - centroids.min;
+			uint32_t axis = 0;
+			if(extent.y > extent[axis]) axis = 1;
+			if(extent.z > extent[axis]) axis = 2;
+
+			if(count <= LEAF_SIZE || extent[axis] <= 0.0f)
+			{
+				if(count <= 0xffff)
+					return leaf();
+
+				/* Every centroid is in the same place, so split anywhere. */
+				axis = 0;
+			}
+
+			uint32_t half = count / 2;
+			uint32_t split = 0;
+			if(depth < SAH_DEPTH && extent[axis] > 0.0f)
+			{
+				/* Sort the centroids into bins, and find the boundary between
+				 * bins that makes for the cheapest pair of children. */
+				uint32_t counts[BINS] = { };
+				Bounds bins[BINS];
+
+				float scale = (float) BINS / extent[axis];
+				auto bin_of = [&](uint32_t t)
+				{
+					float c = b.centroids[t][axis] - centroids.min[axis];
+					return std::min((uint32_t) (c * scale), BINS - 1);
+				};
+				for(uint32_t i = first; i < first + count; ++i)
+				{
+					uint32_t t = b.order[i];
+					uint32_t bin = bin_of(t);
+					counts[bin]++;
+					bins[bin].grow(b.bounds[t]);
+				}
+
+				float right_area[BINS];
+				uint32_t right_count[BINS];
+				Bounds right;
+				uint32_t total = 0;
+				for(uint32_t i = BINS - 1; i > 0; --i)
+				{
+					right.grow(bins[i]);
+					total += counts[i];
+					right_area[i]  = right.area();
+					right_count[i] = total;
+				}
+
+				float best = std::numeric_limits<float>::infinity();
+				Bounds left;
+				total = 0;
+				for(uint32_t i = 0; i + 1 < BINS; ++i)
+				{
+					left.grow(bins[i]);
+					total += counts[i];
+					float cost = left.area() * (float) total
+						+ right_area[i + 1] * (float) right_count[i + 1];
+					if(total > 0 && right_count[i + 1] > 0 && cost < best)
+					{
+						best  = cost;
+						split = i + 1;
+					}
+				}
+
+				/* Splitting costs a box test, which a leaf saves. */
+				float leaf_cost = bounds.area() * (float) count;
+				if(split != 0 && best >= leaf_cost && count <= LEAF_SIZE * 4)
+					return leaf();
+
+				if(split != 0)
+				{
+					auto middle = std::partition(
+						b.order.begin() + first,
+						b.order.begin() + first + count,
+						[&](uint32_t t) { return bin_of(t) < split; });
+					half = (uint32_t) (middle - (b.order.begin() + first));
+				}
+			}
+			if(split == 0)
+			{
+				std::nth_element(
+					b.order.begin() + first,
+					b.order.begin() + first + half,
+					b.order.begin() + first + count,
+					[&](uint32_t i, uint32_t j)
+					{
+						return b.centroids[i][axis] < b.centroids[j][axis];
+					});
+			}
+
+			_nodes[index].count = 0;
+			_nodes[index].axis  = (uint16_t) axis;
+
+			build(b, first, half, depth + 1);
+			uint32_t second = build(b, first + half, count - half, depth + 1);
+			_nodes[index].index = second;
+
+			return index;
+		}
+
+		/* Test the rays of the packet against the given box, returning
+		 * whether any of them goes through it within their range. */
+		static bool overlaps(const BvhNode& node, const RayPacket& rays)
+		{
+			bool any = false;
+			for(uint32_t i = 0; i < PACKET; ++i)
+			{
+				float x0 = (node.min.x - rays.ox[i]) * rays.ix[i];
+				float x1 = (node.max.x - rays.ox[i]) * rays.ix[i];
+				float y0 = (node.min.y - rays.oy[i]) * rays.iy[i];
+				float y1 = (node.max.y - rays.oy[i]) * rays.iy[i];
+				float z0 = (node.min.z - rays.oz[i]) * rays.iz[i];
+				float z1 = (node.max.z - rays.oz[i]) * rays.iz[i];
+
+				float enter = std::max(std::max(std::min(x0, x1), std::min(y0, y1)),
+					std::max(std::min(z0, z1), rays.near[i]));
+				float leave = std::min(std::min(std::max(x0, x1), std::max(y0, y1)),
+					std::min(std::max(z0, z1), rays.far[i]));
+
+				any |= enter <= leave;
+			}
+			return any;
+		}
+
+		/* Test the rays of the packet against the triangle with the given
+		 * index, recording the hits closer than the ones found so far. */
+		void intersect(uint32_t index, RayPacket& rays) const
+		{
+			const BvhTriangle& t = _triangles[index];
+			for(uint32_t i = 0; i < PACKET; ++i)
+			{
+				/* Möller–Trumbore, with every early out turned into a mask. */
+				float px = rays.dy[i] * t.edge2.z - rays.dz[i] * t.edge2.y;
+				float py = rays.dz[i] * t.edge2.x - rays.dx[i] * t.edge2.z;
+				float pz = rays.dx[i] * t.edge2.y - rays.dy[i] * t.edge2.x;
+				float det = t.edge1.x * px + t.edge1.y * py + t.edge1.z * pz;
+				float inv = 1.0f / det;
+
+				float sx = rays.ox[i] - t.origin.x;
+				float sy = rays.oy[i] - t.origin.y;
+				float sz = rays.oz[i] - t.origin.z;
+				float u = (sx * px + sy * py + sz * pz) * inv;
+
+				float qx = sy * t.edge1.z - sz * t.edge1.y;
+				float qy = sz * t.edge1.x - sx * t.edge1.z;
+				float qz = sx * t.edge1.y - sy * t.edge1.x;
+				float v = (rays.dx[i] * qx + rays.dy[i] * qy + rays.dz[i] * qz) * inv;
+				float d = (t.edge2.x * qx + t.edge2.y * qy + t.edge2.z * qz) * inv;
+
+				bool hit = std::fabs(det) > 1e-12f
+					&& u >= 0.0f && v >= 0.0f && u + v <= 1.0f
+					&& d > rays.near[i] && d < rays.far[i];
+
+				rays.far[i] = hit ? d     : rays.far[i];
+				rays.hit[i] = hit ? index : rays.hit[i];
+				rays.u[i]   = hit ? u     : rays.u[i];
+				rays.v[i]   = hit ? v     : rays.v[i];
+			}
+		}
+
+		/* Walk the hierarchy with the given packet, nearest children first.
+		 * When only looking for any hit, rays stop at the first one, and the
+		 * walk stops once all of them have. */
+		template<bool ANY>
+		void traverse(RayPacket& rays) const
+		{
+			if(_nodes.empty())
+				return;
+
+			uint32_t stack[MAX_DEPTH + 1];
+			uint32_t top = 0;
+			stack[top++] = 0;
+
+			while(top > 0)
+			{
+				uint32_t index = stack[--top];
+				const BvhNode& node = _nodes[index];
+				if(!overlaps(node, rays))
+					continue;
+
+				if(node.count > 0)
+				{
+					for(uint32_t i = node.index; i < node.index + node.count; ++i)
+						intersect(i, rays);
+
+					if constexpr(ANY)
+					{
+						bool done = true;
+						for(uint32_t i = 0; i < PACKET; ++i)
+						{
+							if(rays.hit[i] != RayPacket::NO_HIT)
+								rays.far[i] = rays.near[i] - 1.0f;
+							done &= rays.near[i] > rays.far[i];
+						}
+						if(done)
+							return;
+					}
+					continue;
+				}
+
+				/* Visit the child on the side the rays come from first, which
+				 * is the one pushed last. */
+				float direction = node.axis == 0 ? rays.dx[0]
+					: node.axis == 1 ? rays.dy[0] : rays.dz[0];
+				if(direction < 0.0f)
+				{
+					stack[top++] = index + 1;
+					stack[top++] = node.index;
+				}
+				else
+				{
+					stack[top++] = node.index;
+					stack[top++] = index + 1;
+				}
+			}
+		}
+	public:
+		/* Build the hierarchy over all of the given models, replacing what
+		 * was in there before. */
+		void build(const std::vector<Model<Point>>& models)
+		{
+			_nodes.clear();
+			_triangles.clear();
+			_surfaces.clear();
+
+			std::vector<std::array<Point, 3>> surfaces;
+			for(const auto& model : models)
+			{
+				glm::mat4 transform = model.transformation();
+				model.assemble([&](Point a, Point b, Point c)
+				{
+					a.position = transform * a.position;
+					b.position = transform * b.position;
+					c.position = transform * c.position;
+					surfaces.push_back({ a, b, c });
+				});
+			}
+			if(surfaces.empty())
+				return;
+
+			Build b;
+			b.bounds.resize(surfaces.size());
+			b.centroids.resize(surfaces.size());
+			b.order.resize(surfaces.size());
+			for(uint32_t i = 0; i < surfaces.size(); ++i)
+			{
+				for(const auto& point : surfaces[i])
+					b.bounds[i].grow(glm::vec3(point.position));
+				b.centroids[i] = (b.bounds[i].min + b.bounds[i].max) * 0.5f;
+				b.order[i] = i;
+			}
+
+			_nodes.reserve(surfaces.size() * 2);
+			build(b, 0, (uint32_t) surfaces.size(), 0);
+
+			/* Store the triangles in the order the leaves refer to them. */
+			_triangles.reserve(surfaces.size());
+			_surfaces.reserve(surfaces.size());
+			for(auto i : b.order)
+			{
+				glm::vec3 p0 = surfaces[i][0].position;
+				glm::vec3 p1 = surfaces[i][1].position;
+				glm::vec3 p2 = surfaces[i][2].position;
+				_triangles.push_back(BvhTriangle { p0, p1 - p0, p2 - p0 });
+				_surfaces.push_back(surfaces[i]);
+			}
+		}
+
+		/* Find the closest hit of every ray of the packet within its range. */
+		void intersect(RayPacket& rays) const
+		{
+			traverse<false>(rays);
+		}
+
+		/* Find whether every ray of the packet hits anything at all within
+		 * its range, which is all shadow rays need to know. Rays that do get
+		 * a hit, though not necessarily the closest one. */
+		void occluded(RayPacket& rays) const
+		{
+			traverse<true>(rays);
+		}
+
+		/* Point on the given triangle at the given barycentric coordinates,
+		 * with all of its attributes interpolated, in world space. */
+		Point surface(uint32_t index, float u, float v) const
+		{
+			const auto& s = _surfaces[index];
+			float w = 1.0f - u - v;
+
+			Point p;
+			p.texture_index = s[0].texture_index;
+			p.sampler  = s[0].sampler  * w + s[1].sampler  * u + s[2].sampler  * v;
+			p.color    = s[0].color    * w + s[1].color    * u + s[2].color    * v;
+			p.position = s[0].position * w + s[1].position * u + s[2].position * v;
+
+			return p;
+		}
+
+		bool empty() const
+		{
+			return _nodes.empty();
+		}
+
+		const std::vector<BvhNode>& nodes() const
+		{
+			return _nodes;
+		}
+
+		const std::vector<BvhTriangle>& triangles() const
+		{
+			return _triangles;
+		}
+	};
+
 	/* A map is a container for textures and models. */
 	class Map
 	{
@@ -320,8 +1078,218 @@ export namespace map
 		 * accommodate materials with no associated texture data. */
 		std::vector<gfx::Plane<gfx::PixelRgba32>> _textures;
 
+		/* Texture pack the textures are in, for maps that reference theirs
+		 * by hash rather than carry them. Kept for as long as the map lives,
+		 * as the textures use its pixels in place. */
+		std::shared_ptr<const texture_pack> _pack;
+
 		/* Bank of all the model slices used by the map. */
 		std::vector<Model<Point>> _models;
+
+		/* Cells and portals, for maps that have been divided into them. */
+		std::vector<Cell> _cells;
+		std::vector<Portal> _portals;
+
+		/* Hierarchy over all of the triangles of the map. */
+		Bvh _bvh;
+
+		/* Tag at the start of the optional section holding the cells and
+		 * portals, "CELL". */
+		static constexpr uint32_t CELLS_TAG = 0x4c4c4543;
+
+		/* Flag in the number of textures of maps whose textures are in a
+		 * texture pack, in which case every texture in the map is only the
+		 * hash of its contents. */
+		static constexpr uint32_t PACKED_TEXTURES = 0x80000000;
+
+		/* Flag in the number of models of maps whose models are each in a
+		 * section of their own, which may be compressed. */
+		static constexpr uint32_t MODEL_SECTIONS = 0x80000000;
+
+		/* Loads the given number of models, each in a section of its own.
+		 * Every section is made up of the uint32_t size of the model in it
+		 * and the uint32_t size of the section, followed by the section,
+		 * which is the model compressed into a single LZ4 block, if that
+		 * came out any smaller than the model, and the model as is if not.
+		 *
+		 * All of the sections are read up front, and then decompressed and
+		 * loaded on every worker of the given pool, or on the calling thread
+		 * if there is no pool. */
+		void load_sections(std::istream& data, uint32_t models, thread_pool *pool)
+		{
+			auto fail = []()
+			{
+				std::string what = u8"unexpected end of stream while reading \
+					model sections"_fb;
+				throw std::runtime_error(what);
+			};
+
+			/* Nothing gets allocated up front for the number of models nor
+			 * for the sizes of their sections, as all of them come from the
+			 * stream, and would take up to gigabytes if it's corrupt. */
+			std::vector<std::string> sections;
+			std::vector<uint32_t> sizes;
+			for(uint32_t i = 0; i < models; ++i)
+			{
+				uint32_t size, stored;
+				if(!next_uint32_le(data, size))   fail();
+				if(!next_uint32_le(data, stored)) fail();
+
+				/* Sections only get compressed when that makes them smaller,
+				 * and never by more than LZ4 possibly can. */
+				if(stored > size || size > lz4_max_decompressed_size(stored))
+				{
+					std::string what = u8"invalid model section size"_fb;
+					throw std::runtime_error(what);
+				}
+
+				sections.emplace_back();
+				if(!next_bytes(data, sections.back(), stored)) fail();
+				sizes.push_back(size);
+			}
+
+			/* Workers take sections one at a time, as their sizes vary a lot.
+			 * Failures get rethrown once all of the workers are done. */
+			_models.resize(models);
+			std::vector<std::exception_ptr> errors(models);
+			std::atomic<uint32_t> next = 0;
+			wait_group group;
+			bool parallel = pool && models > 1;
+			auto work = [&](uint32_t)
+			{
+				for(uint32_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < models;)
+				{
+					try
+					{
+						std::string model = std::move(sections[i]);
+						if(model.size() < sizes[i])
+						{
+							std::string raw(sizes[i], '\0');
+							if(!lz4_decompress(
+								(const uint8_t*) model.data(), model.size(),
+								(uint8_t*) raw.data(), raw.size()))
+							{
+								std::string what = u8"invalid compressed \
+									model section"_fb;
+								throw std::runtime_error(what);
+							}
+							model = std::move(raw);
+						}
+
+						std::istringstream stream(std::move(model));
+						_models[i] = Model<Point>::load(stream, sizes[i]);
+					}
+					catch(...)
+					{
+						errors[i] = std::current_exception();
+					}
+				}
+				if(parallel)
+					group.done();
+			};
+
+			if(parallel)
+			{
+				group.add(pool->size());
+				for(uint32_t i = 0; i < pool->size(); ++i)
+					pool->submit_job_for(i, make_job(work));
+				group.wait();
+			}
+			else
+				work(0);
+
+			for(auto& error : errors)
+				if(error)
+					std::rethrow_exception(error);
+		}
+
+		/* Loads the cells and portals from the given stream, right after the
+		 * tag of their section has been read.
+		 * The data in the section is expected to be laid out in the following way:
+		 *     |--------|---------------|-------------------------------------|
+		 *     | Offset | Type          | Description                         |
+		 *     |--------|---------------|-------------------------------------|
+		 *     | 0      | uint32_t      | Section tag, "CELL".                |
+		 *     | 4      | uint32_t      | Number of cells in the map.         |
+		 *     | 8      | uint32_t      | Number of portals in the map.       |
+		 *     | 12     | Cell[]        | Packed cells.                       |
+		 *     | ..     | Portal[]      | Packed portals.                     |
+		 *     |--------|---------------|-------------------------------------|
+		 * Where every cell is made up of six floats, for the X, Y and Z of its
+		 * minimum bounds followed by those of its maximum bounds, followed by
+		 * the number of model slices in it and their uint32_t indices. Every
+		 * portal is made up of the uint32_t indices of the cells on its front
+		 * and on its back, followed by the number of points in its outline and
+		 * the X, Y and Z floats of each of them. */
+		void load_cells(std::istream& data)
+		{
+			auto fail = []()
+			{
+				std::string what = u8"unexpected end of stream while reading \
+					cell data"_fb;
+				throw std::runtime_error(what);
+			};
+			auto invalid = []()
+			{
+				std::string what = u8"invalid index in cell data"_fb;
+				throw std::runtime_error(what);
+			};
+			auto vec3 = [&]()
+			{
+				float x, y, z;
+				if(!next_float32_le(data, x)) fail();
+				if(!next_float32_le(data, y)) fail();
+				if(!next_float32_le(data, z)) fail();
+
+				return glm::vec3(x, y, z);
+			};
+
+			uint32_t cells, portals;
+			if(!next_uint32_le(data, cells))   fail();
+			if(!next_uint32_le(data, portals)) fail();
+
+			/* Every count comes from the stream, so containers only grow as
+			 * their elements get read, rather than being sized up front, which
+			 * could take far more memory than a corrupt stream holds. */
+			for(uint32_t i = 0; i < cells; ++i)
+			{
+				Cell& cell = _cells.emplace_back();
+				cell.min = vec3();
+				cell.max = vec3();
+
+				uint32_t models;
+				if(!next_uint32_le(data, models)) fail();
+
+				for(uint32_t j = 0; j < models; ++j)
+				{
+					uint32_t model;
+					if(!next_uint32_le(data, model)) fail();
+					if(model >= _models.size()) invalid();
+					cell.models.push_back(model);
+				}
+			}
+
+			for(uint32_t i = 0; i < portals; ++i)
+			{
+				Portal& portal = _portals.emplace_back();
+				if(!next_uint32_le(data, portal.front)) fail();
+				if(!next_uint32_le(data, portal.back))  fail();
+				if(portal.front >= cells || portal.back >= cells) invalid();
+
+				uint32_t points;
+				if(!next_uint32_le(data, points)) fail();
+
+				for(uint32_t j = 0; j < points; ++j)
+					portal.points.push_back(vec3());
+
+				_cells[portal.front].portals.push_back(i);
+				if(portal.back != portal.front)
+					_cells[portal.back].portals.push_back(i);
+			}
+
+			log_info("{} cells", cells);
+			log_info("{} portals", portals);
+		}
 	public:
 		const gfx::Plane<gfx::PixelRgba32>& texture(uint32_t index) const
 		{
@@ -337,10 +1305,20 @@ export namespace map
 		 *     | 4      | uint32_t      | Number of models in the map.        |
 		 *     | 48     | Texture[]     | Packed textures.                    |
 		 *     | ..     | Model[]       | Packed models.                      |
+		 *     | ..     | Cells         | Optional cells and portals.         |
 		 *     |--------|---------------|-------------------------------------|
 		 * The data from the stream will be copied and put into a new Map object,
-		 * with the exact same parameters as the ones given in the data stream. */
-		static Map load(std::istream &data)
+		 * with the exact same parameters as the ones given in the data stream.
+		 *
+		 * If the top bit of the number of textures is set, every texture is
+		 * instead the 16 byte hash of a texture in the given texture pack,
+		 * which the map then shares rather than copies. If the top bit of the
+		 * number of models is set, the models are in sections, as described
+		 * in `load_sections()`, which get loaded on the given pool. */
+		static Map load(
+			std::istream &data,
+			std::shared_ptr<const texture_pack> pack = nullptr,
+			thread_pool *pool = nullptr)
 		{
 			Map map;
 			uint32_t textures, models;
@@ -357,12 +1335,25 @@ export namespace map
 			if(!next_uint32_le(data, textures)) fail();
 			if(!next_uint32_le(data, models))   fail();
 
-			std::cerr << u8"map contains"_fb << std::endl;
-			std::cerr << textures << u8" textures"_fb << std::endl;
-			std::cerr << models   << u8" models"_fb   << std::endl;
+			bool packed = textures & PACKED_TEXTURES;
+			textures &= ~PACKED_TEXTURES;
+			if(packed && !pack)
+			{
+				std::string what = u8"map textures are in a texture pack, \
+					but none was given"_fb;
+				throw std::runtime_error(what);
+			}
+			if(packed)
+				map._pack = std::move(pack);
+
+			bool sectioned = models & MODEL_SECTIONS;
+			models &= ~MODEL_SECTIONS;
+
+			log_info("map contains");
+			log_info("{} textures", textures);
+			log_info("{} models", models);
 
 			map._textures.reserve(textures + 1);
-			map._models.reserve(models);
 
 			/* Initialize the null texture. */
 			map._textures.emplace_back(1, 1);
@@ -370,11 +1361,38 @@ export namespace map
 
 			/* Initialize all of the other textures. */
 			for(uint32_t i = 0; i < textures; ++i)
-				map._textures.push_back(load_texture_rgba32(data));
+				if(packed)
+					map._textures.push_back(find_texture_rgba32(data, *map._pack));
+				else
+					map._textures.push_back(load_texture_rgba32(data));
 
 			/* Initialize all of the modules. */
-			for(uint32_t i = 0; i < models; ++i)
-				map._models.push_back(Model<Point>::load(data));
+			/* Sections only make room for their models once all of them
+			 * have been read, rather than trusting the number of models in
+			 * the stream. */
+			if(sectioned)
+				map.load_sections(data, models, pool);
+			else
+			{
+				map._models.reserve(models);
+				for(uint32_t i = 0; i < models; ++i)
+					map._models.push_back(Model<Point>::load(data));
+			}
+
+			map._bvh.build(map._models);
+			log_info("{} bvh nodes", map._bvh.nodes().size());
+
+			/* Cells and portals are optional and come last, so older maps,
+			 * which end right after the models, still load. */
+			uint32_t tag;
+			if(!next_uint32_le(data, tag))
+				return map;
+			if(tag != CELLS_TAG)
+			{
+				std::string what = u8"unknown section in map data"_fb;
+				throw std::runtime_error(what);
+			}
+			map.load_cells(data);
 
 			return map;
 		}
@@ -384,9 +1402,142 @@ export namespace map
 			return _textures;
 		}
 
+		/* Spreads the textures over the memory of all of the NUMA nodes, as
+		 * they get sampled by the workers of every node alike. Textures in a
+		 * texture pack are left where the page cache put them, as their pages
+		 * are shared with every other process using the pack. */
+		void interleave(const numa_topology& topology)
+		{
+			if(_pack)
+				return;
+			for(auto& texture : _textures)
+				texture.interleave(topology);
+		}
+
 		const std::vector<Model<Point>>& models() const
 		{
 			return _models;
 		}
+
+		/* Cells the map is divided into. Empty for maps with no cells, in
+		 * which case everything should be considered visible. */
+		const std::vector<Cell>& cells() const
+		{
+			return _cells;
+		}
+
+		const std::vector<Portal>& portals() const
+		{
+			return _portals;
+		}
+
+		/* Bounding volume hierarchy over all of the triangles of the map,
+		 * for tracing rays. */
+		const Bvh& bvh() const
+		{
+			return _bvh;
+		}
+
+		/* Index of the first cell containing the given point in world space,
+		 * if there is any. */
+		std::optional<uint32_t> cell_at(glm::vec3 point) const
+		{
+			for(uint32_t i = 0; i < _cells.size(); ++i)
+				if(_cells[i].contains(point))
+					return i;
+			return {};
+		}
+	};
+
+	/* Maps that have been loaded and are still in use by someone, keyed by
+	 * the path they were loaded from. Maps are immutable once loaded, so any
+	 * number of games playing on the same map, on any number of threads,
+	 * share a single copy of its textures, geometry and hierarchy, and keep
+	 * everything they change about the world to themselves. A map is freed
+	 * as soon as the last game holding it lets go of it.
+	 *
+	 * Maps whose textures are in a texture pack get the pack kept next to
+	 * them, "textures.pack", which is mapped once for all of the maps using
+	 * it. */
+	class MapCache
+	{
+	protected:
+		std::mutex _lock;
+		std::map<std::string, std::weak_ptr<const Map>> _maps;
+		std::map<std::string, std::weak_ptr<const texture_pack>> _packs;
+
+		/* Returns the texture pack next to the map at the given path, if
+		 * there is a valid one. Must be called with the lock held. */
+		std::shared_ptr<const texture_pack> pack_of(const std::string& path)
+		{
+			auto slash = path.find_last_of('/');
+			auto dir   = slash == std::string::npos
+				? std::string()
+				: path.substr(0, slash + 1);
+			auto name  = dir + "textures.pack";
+
+			if(auto found = _packs.find(name); found != _packs.end())
+			{
+				if(auto pack = found->second.lock())
+					return pack;
+			}
+
+			auto pack = std::make_shared<texture_pack>();
+			if(!pack->open(name))
+				return nullptr;
+
+			_packs[name] = pack;
+			return pack;
+		}
+	public:
+		/* The cache shared by every game in the process. */
+		static MapCache& shared()
+		{
+			static MapCache cache;
+			return cache;
+		}
+
+		/* Returns the map at the given path, loading it if nobody is holding
+		 * on to it yet. A map that gets loaded is spread over the memory of
+		 * all of the given NUMA nodes before it's handed out, which only
+		 * happens once, by whoever loads it first. Models are loaded on the
+		 * given pool, if there is one.
+		 *
+		 * The lock is held while loading, so that a map requested by several
+		 * games at once is only loaded by one of them. Loading is rare enough
+		 * for this to be of no consequence to maps other than the one being
+		 * loaded. */
+		std::shared_ptr<const Map> load(
+			const std::string& path,
+			const numa_topology& topology = numa_topology(),
+			thread_pool *pool = nullptr)
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			if(auto found = _maps.find(path); found != _maps.end())
+			{
+				if(auto map = found->second.lock())
+					return map;
+			}
+
+			/* Forget about the maps nobody holds anymore. */
+			auto expired = [](const auto& entry)
+			{
+				return entry.second.expired();
+			};
+			std::erase_if(_maps,  expired);
+			std::erase_if(_packs, expired);
+
+			std::ifstream data;
+			data.open(path, std::ios_base::in | std::ios_base::binary);
+			if(!data)
+				throw std::runtime_error("could not open " + path);
+
+			auto loaded = std::make_shared<Map>(Map::load(data, pack_of(path), pool));
+			loaded->interleave(topology);
+
+			std::shared_ptr<const Map> map = std::move(loaded);
+			_maps[path] = map;
+			return map;
+		}
 	};
 };
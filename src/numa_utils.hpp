@@ -0,0 +1,251 @@
+#pragma once
+
+#include <cstddef>              //std::size_t
+#include <cstdint>              //std::uint32_t, std::uint64_t
+#include <fstream>              //std::ifstream
+#include <stdexcept>            //std::exception
+#include <string>               //std::string, std::to_string
+#include <vector>               //std::vector
+
+#include "thread_utils.hpp"     //thread_pool, wait_group, make_job
+
+#ifdef __linux__
+#include <pthread.h>            //pthread_self, pthread_setaffinity_np
+#include <sched.h>              //cpu_set_t, CPU_ZERO, CPU_SET
+#include <sys/syscall.h>        //SYS_mbind
+#include <unistd.h>             //syscall, sysconf
+#endif
+
+/*
+ * NUMA topology and memory placement, without libnuma.
+ *
+ * The topology is read from sysfs, memory gets placed with the `mbind` system call
+ * and threads get pinned through their affinity masks. Everything in here degrades
+ * to a no-op on machines with a single node, or on systems other than Linux, so it
+ * can be called unconditionally.
+ *
+ * Placement works on whole pages, so only memory aligned to pages should be placed,
+ * such as that of a `gfx::Plane`. Pages are moved if they have already been touched,
+ * so memory can be placed at any time, but placing it before it's first written to
+ * is cheaper.
+ */
+
+/**
+ * A memory node, along with the CPUs that are local to it.
+ */
+struct numa_node {
+    std::uint32_t id = 0;
+    std::vector<std::uint32_t> cpus;
+};
+
+/**
+ * Parses a sysfs CPU or node list, such as "0-3,8-11".
+ */
+inline std::vector<std::uint32_t> numa_parse_list(const std::string& list) {
+    std::vector<std::uint32_t> r;
+    std::size_t i = 0;
+    while(i < list.size()) {
+        auto end = list.find(',', i);
+        if(end == std::string::npos) {
+            end = list.size();
+        }
+        const auto range = list.substr(i, end - i);
+        const auto dash = range.find('-');
+        try {
+            const auto first = std::stoul(range.substr(0, dash));
+            const auto last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+            for(auto n = first; n <= last; n++) {
+                r.push_back((std::uint32_t)n);
+            }
+        } catch(const std::exception&) {
+            //a trailing newline or garbage, skip it
+        }
+        i = end + 1;
+    }
+    return r;
+}
+
+/**
+ * The memory nodes of the machine. Machines without NUMA, or whose topology can't
+ * be read, have a single node with no CPUs listed.
+ */
+class numa_topology {
+private:
+    std::vector<numa_node> node_list = std::vector<numa_node>(1);
+
+    static std::string read_line(const std::string& path) {
+        std::ifstream f(path);
+        std::string line;
+        std::getline(f, line);
+        return line;
+    }
+public:
+    /**
+     * Reads the topology of the current machine.
+     */
+    static numa_topology detect() {
+        numa_topology t;
+#ifdef __linux__
+        std::vector<numa_node> nodes;
+        for(auto id : numa_parse_list(read_line("/sys/devices/system/node/online"))) {
+            numa_node n;
+            n.id = id;
+            n.cpus = numa_parse_list(read_line("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"));
+            nodes.push_back(std::move(n));
+        }
+        if(!nodes.empty()) {
+            t.node_list = std::move(nodes);
+        }
+#endif
+        return t;
+    }
+
+    /**
+     * Creates a topology with a single node, which is what machines without NUMA
+     * look like.
+     */
+    numa_topology() {}
+
+    /**
+     * Returns the number of memory nodes, which is always at least one.
+     */
+    std::uint32_t nodes() const noexcept { return (std::uint32_t)node_list.size(); }
+
+    /**
+     * Returns the node with the given index, in the range [0, nodes()). Indices
+     * aren't necessarily the same as the ids the system uses.
+     */
+    const numa_node& node(std::uint32_t index) const noexcept { return node_list[index]; }
+
+    /**
+     * Returns the index of the node a worker of a thread pool belongs to. Workers are
+     * dealt round-robin, so that any number of active workers is spread evenly.
+     */
+    std::uint32_t node_of_worker(std::uint32_t worker) const noexcept { return worker % nodes(); }
+
+    /**
+     * Returns the index of the node a row of a plane belongs to, when the plane is
+     * split into one band of rows per node.
+     */
+    std::uint32_t node_of_row(std::uint32_t row, std::uint32_t height) const noexcept {
+        if(height == 0) {
+            return 0;
+        }
+        return (std::uint32_t)((std::uint64_t)row * nodes() / height);
+    }
+};
+
+/**
+ * Returns the size of a page of memory.
+ */
+inline std::size_t numa_page_size() noexcept {
+#ifdef __linux__
+    const auto size = sysconf(_SC_PAGESIZE);
+    if(size > 0) {
+        return (std::size_t)size;
+    }
+#endif
+    return 4096;
+}
+
+#ifdef __linux__
+namespace numa_detail {
+    //from <linux/mempolicy.h>, which isn't always installed
+    constexpr int MPOL_PREFERRED = 1;
+    constexpr int MPOL_INTERLEAVE = 3;
+    constexpr unsigned MPOL_MF_MOVE = 1u << 1;
+
+    inline bool mbind(void* addr, std::size_t len, int mode, std::uint64_t mask) noexcept {
+        //round inwards to whole pages, so that no memory outside of the range changes
+        const auto page = numa_page_size();
+        auto begin = ((std::uintptr_t)addr + page - 1) / page * page;
+        auto end = ((std::uintptr_t)addr + len) / page * page;
+        if(end <= begin) {
+            return true;
+        }
+        return syscall(SYS_mbind, begin, end - begin, mode, &mask, 64, MPOL_MF_MOVE) == 0;
+    }
+}
+#endif
+
+/**
+ * Places the pages in the given range on the memory of the given node. This is a
+ * preference, so memory is still handed out from other nodes if that one is full.
+ * Returns whether the placement succeeded.
+ */
+inline bool numa_bind(void* addr, std::size_t len, const numa_topology& topology, std::uint32_t node) noexcept {
+#ifdef __linux__
+    if(topology.nodes() > 1 && topology.node(node).id < 64) {
+        return numa_detail::mbind(addr, len, numa_detail::MPOL_PREFERRED, std::uint64_t(1) << topology.node(node).id);
+    }
+#else
+    (void)addr; (void)len; (void)topology; (void)node;
+#endif
+    return true;
+}
+
+/**
+ * Spreads the pages in the given range over the memory of all nodes, for memory
+ * that gets read from every node alike. Returns whether the placement succeeded.
+ */
+inline bool numa_interleave(void* addr, std::size_t len, const numa_topology& topology) noexcept {
+#ifdef __linux__
+    if(topology.nodes() > 1) {
+        std::uint64_t mask = 0;
+        for(std::uint32_t i = 0; i < topology.nodes(); i++) {
+            if(topology.node(i).id < 64) {
+                mask |= std::uint64_t(1) << topology.node(i).id;
+            }
+        }
+        return numa_detail::mbind(addr, len, numa_detail::MPOL_INTERLEAVE, mask);
+    }
+#else
+    (void)addr; (void)len; (void)topology;
+#endif
+    return true;
+}
+
+/**
+ * Pins the calling thread to the CPUs of the given node. Returns whether pinning
+ * succeeded.
+ */
+inline bool numa_pin_current_thread(const numa_topology& topology, std::uint32_t node) noexcept {
+#ifdef __linux__
+    const auto& cpus = topology.node(node).cpus;
+    if(topology.nodes() <= 1 || cpus.empty()) {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(auto cpu : cpus) {
+        if(cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)topology; (void)node;
+    return true;
+#endif
+}
+
+/**
+ * Pins every worker of a pool, parked or not, to the CPUs of the node given by
+ * `numa_topology::node_of_worker`, so that memory they first touch ends up local
+ * to them, and the scheduler never moves them away from it.
+ */
+inline void numa_pin_pool(thread_pool& pool, const numa_topology& topology) {
+    if(topology.nodes() <= 1) {
+        return;
+    }
+    wait_group group;
+    auto pin = [&](std::uint32_t id) {
+        numa_pin_current_thread(topology, topology.node_of_worker(id));
+        group.done();
+    };
+    group.add(pool.size());
+    for(std::uint32_t i = 0; i < pool.size(); i++) {
+        pool.submit_job_for(i, make_job(pin));
+    }
+    group.wait();
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstddef>              //std::size_t
+#include <cstdint>              //std::uint8_t, std::uint32_t, std::uint64_t
+#include <cstring>              //std::memcmp
+#include <string>               //std::string
+
+#include <fcntl.h>              //open, O_RDONLY, O_CLOEXEC
+#include <sys/mman.h>           //mmap, munmap
+#include <sys/stat.h>           //fstat
+#include <unistd.h>             //close
+
+/*
+ * A pack of textures, addressed by a hash of their contents, mapped read-only into
+ * memory.
+ *
+ * Every process that opens the same pack maps the same file, so the textures in it
+ * live once in the page cache of the machine, however many processes sample them.
+ * The pixels are used in place, and never copied out of the mapping. Packs are only
+ * ever replaced as a whole, by renaming a new file over the old one, so a pack that
+ * has been opened never changes under the processes that use it.
+ *
+ * The pack is laid out in the following way, with every number in little endian:
+ *     |--------|---------------|------------------------------------------------|
+ *     | Offset | Type          | Description                                    |
+ *     |--------|---------------|------------------------------------------------|
+ *     | 0      | uint32_t      | Magic, "QTEX".                                 |
+ *     | 4      | uint32_t      | Version.                                       |
+ *     | 8      | uint32_t      | Number of textures in the pack.                |
+ *     | 12     | uint32_t      | Reserved, zero.                                |
+ *     | 16     | Entry[]       | Entries, sorted by hash.                       |
+ *     | ..     | uint8_t[]     | Pixels of each texture, aligned to pages.      |
+ *     |--------|---------------|------------------------------------------------|
+ * Where every entry is made up of the 16 bytes of the hash of the texture, followed
+ * by the uint64_t offset of its pixels from the start of the pack and its uint32_t
+ * width and height. Pixels are in row-major, four bytes each, red first.
+ */
+class texture_pack {
+public:
+    static constexpr std::uint32_t MAGIC = 0x58455451;  //"QTEX"
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::size_t HASH_SIZE = 16;
+    static constexpr std::size_t HEADER_SIZE = 16;
+    static constexpr std::size_t ENTRY_SIZE = 32;
+    static constexpr std::size_t PIXEL_SIZE = 4;
+
+    /**
+     * A texture in the pack, with its pixels still in the mapping.
+     */
+    struct texture {
+        const std::uint8_t* pixels = nullptr;
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+    };
+private:
+    const std::uint8_t* base = nullptr;
+    std::size_t size = 0;
+    std::uint32_t count = 0;
+
+    //prevent copying
+    texture_pack(const texture_pack&) = delete;
+    texture_pack& operator=(const texture_pack&) = delete;
+
+    static std::uint64_t read_le(const std::uint8_t* p, std::size_t bytes) noexcept {
+        std::uint64_t v = 0;
+        for(std::size_t i = 0; i < bytes; i++) {
+            v |= (std::uint64_t)p[i] << (8 * i);
+        }
+        return v;
+    }
+
+    const std::uint8_t* entry(std::uint32_t index) const noexcept {
+        return base + HEADER_SIZE + (std::size_t)index * ENTRY_SIZE;
+    }
+
+    texture at(std::uint32_t index) const noexcept {
+        const auto e = entry(index);
+        texture t;
+        t.pixels = base + read_le(e + HASH_SIZE, 8);
+        t.width = (std::uint32_t)read_le(e + HASH_SIZE + 8, 4);
+        t.height = (std::uint32_t)read_le(e + HASH_SIZE + 12, 4);
+        return t;
+    }
+
+    //checks everything lookups rely on, so that they needn't check anything
+    bool validate() const noexcept {
+        if(size < HEADER_SIZE || read_le(base, 4) != MAGIC || read_le(base + 4, 4) != VERSION) {
+            return false;
+        }
+        const auto entries = read_le(base + 8, 4);
+        if(entries > (size - HEADER_SIZE) / ENTRY_SIZE) {
+            return false;
+        }
+        for(std::uint32_t i = 0; i < entries; i++) {
+            const auto e = entry(i);
+            const auto offset = read_le(e + HASH_SIZE, 8);
+            const auto pixels = read_le(e + HASH_SIZE + 8, 4) * read_le(e + HASH_SIZE + 12, 4);
+            //pixels get used in place, so they have to be aligned like them
+            if(offset > size || offset % PIXEL_SIZE != 0 || pixels > (size - offset) / PIXEL_SIZE) {
+                return false;
+            }
+            if(i > 0 && std::memcmp(entry(i - 1), e, HASH_SIZE) >= 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+public:
+    explicit texture_pack() {}
+
+    ~texture_pack() {
+        close();
+    }
+
+    /**
+     * Maps the pack at the given path. Returns whether the pack could be mapped and
+     * is well formed.
+     */
+    bool open(const std::string& path) noexcept {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, (std::size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(p == MAP_FAILED) {
+            return false;
+        }
+
+        base = static_cast<const std::uint8_t*>(p);
+        size = (std::size_t)st.st_size;
+        if(!validate()) {
+            close();
+            return false;
+        }
+        count = (std::uint32_t)read_le(base + 8, 4);
+        return true;
+    }
+
+    /**
+     * Unmaps the pack. Textures found in it must not be used anymore.
+     */
+    void close() noexcept {
+        if(base) {
+            munmap(const_cast<std::uint8_t*>(base), size);
+        }
+        base = nullptr;
+        size = 0;
+        count = 0;
+    }
+
+    bool is_open() const noexcept { return base != nullptr; }
+
+    /**
+     * Returns the number of textures in the pack.
+     */
+    std::uint32_t textures() const noexcept { return count; }
+
+    /**
+     * Looks up the texture with the given hash, of `HASH_SIZE` bytes. Returns whether
+     * the pack has it.
+     */
+    bool find(const std::uint8_t* hash, texture& t) const noexcept {
+        std::uint32_t first = 0;
+        std::uint32_t last = count;
+        while(first < last) {
+            const auto middle = first + (last - first) / 2;
+            const auto order = std::memcmp(entry(middle), hash, HASH_SIZE);
+            if(order == 0) {
+                t = at(middle);
+                return true;
+            }
+            if(order < 0) {
+                first = middle + 1;
+            } else {
+                last = middle;
+            }
+        }
+        return false;
+    }
+};
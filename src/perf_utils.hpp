@@ -0,0 +1,281 @@
+#pragma once
+
+#include <atomic>               //std::atomic, std::memory_order_*
+#include <cstdint>              //std::uint32_t, std::uint64_t
+#include <cstring>              //std::memset
+#include <ostream>              //std::ostream
+
+#ifdef __linux__
+#include <linux/perf_event.h>   //perf_event_attr, PERF_*
+#include <sys/syscall.h>        //SYS_perf_event_open
+#include <unistd.h>             //syscall, read, close
+#endif
+
+/*
+ * Hardware performance counters, attributed to the stages of the pipeline.
+ *
+ * Every thread that enters a `perf_scope` while sampling is enabled opens its own
+ * group of counters through `perf_event_open`, counting only that thread. Counts
+ * are charged to the innermost scope the thread is in, so nested stages are never
+ * counted twice. Reading the counters takes a system call, so scopes should wrap
+ * batches of work, never single pixels.
+ *
+ * Sampling is disabled by default, in which case scopes cost a relaxed load.
+ */
+
+/**
+ * Pipeline stages counters can be attributed to.
+ */
+enum class perf_stage : std::uint32_t {
+    vertex,
+    setup,
+    raster,
+    painter,
+    clear,
+    present,
+    count
+};
+
+inline const char* perf_stage_name(perf_stage stage) noexcept {
+    switch(stage) {
+        case perf_stage::vertex:  return "vertex";
+        case perf_stage::setup:   return "setup";
+        case perf_stage::raster:  return "raster";
+        case perf_stage::painter: return "painter";
+        case perf_stage::clear:   return "clear";
+        case perf_stage::present: return "present";
+        default:                  return "?";
+    }
+}
+
+/**
+ * Values of all the counters in a group.
+ */
+struct perf_counters {
+    std::uint64_t cycles = 0;
+    std::uint64_t instructions = 0;
+    std::uint64_t llc_misses = 0;
+    std::uint64_t branch_misses = 0;
+
+    perf_counters& operator+=(const perf_counters& rhs) noexcept {
+        cycles += rhs.cycles;
+        instructions += rhs.instructions;
+        llc_misses += rhs.llc_misses;
+        branch_misses += rhs.branch_misses;
+        return *this;
+    }
+
+    perf_counters operator-(const perf_counters& rhs) const noexcept {
+        perf_counters r;
+        r.cycles = cycles - rhs.cycles;
+        r.instructions = instructions - rhs.instructions;
+        r.llc_misses = llc_misses - rhs.llc_misses;
+        r.branch_misses = branch_misses - rhs.branch_misses;
+        return r;
+    }
+};
+
+namespace perf_detail {
+    //maximum number of threads that get their own counters, threads past this
+    //limit all share the last slot
+    constexpr std::uint32_t MAX_THREADS = 256;
+    constexpr std::uint32_t STAGES = static_cast<std::uint32_t>(perf_stage::count);
+
+    struct alignas(64) slot {
+        std::atomic<std::uint64_t> values[STAGES][4] = {};
+    };
+
+    inline slot slots[MAX_THREADS];
+    inline std::atomic<std::uint32_t> next_slot { 0 };
+    inline std::atomic<bool> enabled { false };
+
+    /**
+     * Counter group of a single thread, along with the stage it's currently in.
+     */
+    struct thread_state {
+        int leader = -1;
+        int fds[4] = { -1, -1, -1, -1 };
+        bool opened = false;
+        slot* counters = nullptr;
+
+        perf_stage stage = perf_stage::count;
+        perf_counters last;
+
+        ~thread_state() {
+#ifdef __linux__
+            for(auto fd : fds) {
+                if(fd >= 0) close(fd);
+            }
+#endif
+        }
+
+        bool open() noexcept {
+            if(opened) return leader >= 0;
+            opened = true;
+
+            auto i = next_slot.fetch_add(1, std::memory_order_relaxed);
+            counters = &slots[i < MAX_THREADS ? i : MAX_THREADS - 1];
+#ifdef __linux__
+            const std::uint64_t configs[4] = {
+                PERF_COUNT_HW_CPU_CYCLES,
+                PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_BRANCH_MISSES
+            };
+            for(int j = 0; j < 4; j++) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = configs[j];
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+
+                //count this thread only, on any cpu
+                fds[j] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+                if(fds[j] < 0) {
+                    for(auto& fd : fds) {
+                        if(fd >= 0) close(fd);
+                        fd = -1;
+                    }
+                    leader = -1;
+                    return false;
+                }
+                if(j == 0) leader = fds[0];
+            }
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        perf_counters read_group() noexcept {
+            perf_counters r;
+#ifdef __linux__
+            struct { std::uint64_t nr; std::uint64_t values[4]; } data;
+            if(::read(leader, &data, sizeof(data)) == (ssize_t)sizeof(data)) {
+                r.cycles = data.values[0];
+                r.instructions = data.values[1];
+                r.llc_misses = data.values[2];
+                r.branch_misses = data.values[3];
+            }
+#endif
+            return r;
+        }
+
+        //charges everything counted since the last transition to the current stage
+        void charge(const perf_counters& now) noexcept {
+            if(stage != perf_stage::count) {
+                auto d = now - last;
+                auto& v = counters->values[static_cast<std::uint32_t>(stage)];
+                v[0].fetch_add(d.cycles, std::memory_order_relaxed);
+                v[1].fetch_add(d.instructions, std::memory_order_relaxed);
+                v[2].fetch_add(d.llc_misses, std::memory_order_relaxed);
+                v[3].fetch_add(d.branch_misses, std::memory_order_relaxed);
+            }
+            last = now;
+        }
+    };
+
+    inline thread_local thread_state state;
+}
+
+/**
+ * Enables or disables sampling. Returns whether counters could be opened for the
+ * calling thread, which is a good indication of whether they'll be available to
+ * the other threads as well (they're usually not, for instance, when
+ * `perf_event_paranoid` is too high or inside of some containers).
+ */
+inline bool perf_enable(bool enable = true) noexcept {
+    perf_detail::enabled.store(enable, std::memory_order_relaxed);
+    return !enable || perf_detail::state.open();
+}
+
+/**
+ * Returns whether sampling is enabled.
+ */
+inline bool perf_enabled() noexcept {
+    return perf_detail::enabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * Returns the counters charged to the given stage, either summed over all threads
+ * or, if a thread index is given, for that thread only.
+ */
+inline perf_counters perf_stage_counters(perf_stage stage, int thread = -1) noexcept {
+    perf_counters r;
+    auto n = perf_detail::next_slot.load(std::memory_order_relaxed);
+    if(n > perf_detail::MAX_THREADS) {
+        n = perf_detail::MAX_THREADS;
+    }
+    for(std::uint32_t i = 0; i < n; i++) {
+        if(thread >= 0 && (std::uint32_t)thread != i) continue;
+        auto& v = perf_detail::slots[i].values[static_cast<std::uint32_t>(stage)];
+        r.cycles += v[0].load(std::memory_order_relaxed);
+        r.instructions += v[1].load(std::memory_order_relaxed);
+        r.llc_misses += v[2].load(std::memory_order_relaxed);
+        r.branch_misses += v[3].load(std::memory_order_relaxed);
+    }
+    return r;
+}
+
+/**
+ * Returns the number of threads that have counters.
+ */
+inline std::uint32_t perf_threads() noexcept {
+    auto n = perf_detail::next_slot.load(std::memory_order_relaxed);
+    return n < perf_detail::MAX_THREADS ? n : perf_detail::MAX_THREADS;
+}
+
+/**
+ * Charges the counters of the current thread to the given stage for as long as
+ * this object is alive.
+ */
+class perf_scope {
+private:
+    bool active;
+    perf_stage previous;
+
+    //prevent copying
+    perf_scope(const perf_scope&) = delete;
+    perf_scope& operator=(const perf_scope&) = delete;
+public:
+    explicit perf_scope(perf_stage stage) noexcept: active(false), previous(perf_stage::count) {
+        if(!perf_enabled()) return;
+        auto& s = perf_detail::state;
+        if(!s.open()) return;
+
+        active = true;
+        previous = s.stage;
+        s.charge(s.read_group());
+        s.stage = stage;
+    }
+
+    ~perf_scope() {
+        if(!active) return;
+        auto& s = perf_detail::state;
+        s.charge(s.read_group());
+        s.stage = previous;
+    }
+};
+
+/**
+ * Writes a table with the counters of every stage, summed over all threads.
+ */
+inline void perf_report(std::ostream& out) {
+    out << "stage      cycles          instructions    ipc    llc-misses    branch-misses\n";
+    for(std::uint32_t i = 0; i < perf_detail::STAGES; i++) {
+        auto stage = static_cast<perf_stage>(i);
+        auto c = perf_stage_counters(stage);
+        double ipc = c.cycles ? (double)c.instructions / (double)c.cycles : 0.0;
+
+        out.width(11); out << std::left << perf_stage_name(stage);
+        out.width(16); out << c.cycles;
+        out.width(16); out << c.instructions;
+        out.width(7);  out.precision(2); out << std::fixed << ipc;
+        out.width(14); out << c.llc_misses;
+        out << c.branch_misses << "\n";
+    }
+    out << std::right;
+}
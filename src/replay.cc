@@ -0,0 +1,194 @@
+/* replay.cc - Frame capture replayer. Draws the frames in a capture made by
+ * the game over and over again, running nothing but the raster and painter
+ * stages, with as many different thread counts as asked for, and reports how
+ * long drawing every one of them took. */
+#include <glm/glm.hpp>			/* For mathematics.				*/
+#include "thread_utils.hpp"		/* For the default concurrency.	*/
+#include "perf_utils.hpp"		/* For per-stage counters.		*/
+
+import <iostream>;
+import <fstream>;
+import <sstream>;
+import <string>;
+import <chrono>;
+import <vector>;
+import <algorithm>;
+import <cmath>;
+import gfx;		/* For the rasterizer.		*/
+import map;		/* For the captured points.	*/
+
+using Pixel = gfx::PixelRgba32;
+using Raster = gfx::Raster<map::Point, map::PointSlope>;
+
+/* Draws every frame in the given capture `repeat` times with a raster running
+ * on the given number of threads, printing a summary of how long it took. */
+void replay(const std::string& capture, uint32_t threads, uint64_t repeat)
+{
+	Raster raster(threads);
+
+	/* Targets of the painter. Captures may change viewport between frames,
+	 * so these are kept as plain buffers that get resized to fit. */
+	std::vector<Pixel> screen;
+	std::vector<float> depth;
+
+	/* These have to be kept in sync with the ones in the game, as they're the
+	 * only stages that get run again. */
+	raster.screen = [&](map::Point p)
+	{
+		int32_t x = std::round((p.position.x + 1.0) * (double) raster.width()  / 2.0);
+		int32_t y = std::round((p.position.y + 1.0) * (double) raster.height() / 2.0);
+		y = (int32_t) raster.height() - y;
+
+		return std::make_tuple(x, y);
+	};
+	raster.slope = [](map::Point a, map::Point b)
+	{
+		return map::PointSlope(a, b);
+	};
+	raster.painter = [&](uint32_t x, uint32_t y, map::Point p)
+	{
+		size_t i = (size_t) y * raster.width() + x;
+		if(depth[i] < p.position.z)
+			return;
+		depth[i] = p.position.z;
+
+		glm::vec3 color = p.color;
+		screen[i].red   = color.x / std::max(p.position.z / 10.0f, 1.0f);
+		screen[i].green = color.y / std::max(p.position.z / 10.0f, 1.0f);
+		screen[i].blue  = color.z / std::max(p.position.z / 10.0f, 1.0f);
+		screen[i].alpha = 255;
+	};
+	raster.depth = [](map::Point p)
+	{
+		return p.position.z;
+	};
+	raster.span_painter = [&](uint32_t y, uint32_t x0, uint32_t x1, map::Point p0, map::Point p1)
+	{
+		map::PointSlope slope(p0, p1);
+		for(uint32_t x = x0; x < x1; ++x)
+		{
+			map::Point p = slope.at((double) (x - x0) / (double) (x1 - x0));
+			size_t i = (size_t) y * raster.width() + x;
+			depth[i] = p.position.z;
+
+			glm::vec3 color = p.color;
+			screen[i].red   = color.x / std::max(p.position.z / 10.0f, 1.0f);
+			screen[i].green = color.y / std::max(p.position.z / 10.0f, 1.0f);
+			screen[i].blue  = color.z / std::max(p.position.z / 10.0f, 1.0f);
+			screen[i].alpha = 255;
+		}
+	};
+
+	using Clock    = std::chrono::steady_clock;
+	using Duration = std::chrono::duration<double, std::milli>;
+
+	std::vector<double> times;
+	uint64_t fragments = 0;
+	for(uint64_t i = 0; i < repeat; ++i)
+	{
+		std::istringstream in(capture, std::ios_base::in | std::ios_base::binary);
+		while(raster.inject(in))
+		{
+			size_t pixels = (size_t) raster.width() * raster.height();
+			screen.resize(pixels);
+
+			/* (+1.0 / 0.0) yields +Infinity, such that n < depth == true for any n */
+			depth.assign(pixels, +1.0 / 0.0);
+
+			auto begin = Clock::now();
+			raster.flush();
+			auto end = Clock::now();
+
+			times.push_back(std::chrono::duration_cast<Duration>(end - begin).count());
+			fragments += raster.stats().fragments;
+		}
+	}
+
+	std::cout << "threads " << threads << ": ";
+	if(times.empty())
+	{
+		std::cout << "no frames" << std::endl;
+		return;
+	}
+
+	std::sort(times.begin(), times.end());
+	double total = 0.0;
+	for(auto time : times)
+		total += time;
+
+	std::cout << times.size() << " frames, "
+		<< "mean " << total / times.size() << "ms, "
+		<< "median " << times[times.size() / 2] << "ms, "
+		<< "p99 " << times[times.size() * 99 / 100] << "ms, "
+		<< "max " << times.back() << "ms, "
+		<< fragments / times.size() << " fragments per frame" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	std::string path;
+	std::vector<uint32_t> threads;
+	uint64_t repeat = 1;
+	bool perf = false;
+
+	auto usage = [&]()
+	{
+		std::cerr << "usage: " << argv[0];
+		std::cerr << " [--threads <n>[,<n>...]] [--repeat <n>] [--perf] <capture>";
+		std::cerr << std::endl;
+		return 1;
+	};
+
+	for(int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if(arg == "--threads" && i + 1 < argc)
+		{
+			std::stringstream list(argv[++i]);
+			std::string count;
+			while(std::getline(list, count, ','))
+				threads.push_back(std::stoul(count));
+		}
+		else if(arg == "--repeat" && i + 1 < argc)
+			repeat = std::stoull(argv[++i]);
+		else if(arg == "--perf")
+			perf = true;
+		else if(path.empty() && arg.rfind("--", 0) != 0)
+			path = arg;
+		else
+			return usage();
+	}
+	if(path.empty())
+		return usage();
+	if(threads.empty())
+		threads.push_back(thread_pool::default_concurrency());
+
+	/* Split the raster and painter stages, the same way the game does. */
+	if(perf && !perf_enable())
+		std::cerr << "warning: could not open performance counters, "
+			"check /proc/sys/kernel/perf_event_paranoid" << std::endl;
+
+	std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+	if(!file)
+	{
+		std::cerr << "could not open " << path << std::endl;
+		return 1;
+	}
+	std::stringstream capture;
+	capture << file.rdbuf();
+
+	for(auto count : threads)
+	{
+		if(count == 0)
+			return usage();
+		replay(capture.str(), count, repeat);
+	}
+
+	if(perf_enabled())
+	{
+		std::cout << std::endl;
+		perf_report(std::cout);
+	}
+
+	return 0;
+}
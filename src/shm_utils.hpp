@@ -0,0 +1,329 @@
+#pragma once
+
+#include <atomic>               //std::atomic, std::atomic_thread_fence, std::memory_order_*
+#include <cerrno>               //errno, ETIMEDOUT
+#include <climits>              //INT_MAX
+#include <cstddef>              //std::size_t
+#include <cstdint>              //std::uint32_t, std::uint64_t, UINT64_MAX
+#include <ctime>                //timespec
+#include <string>               //std::string
+
+#include <fcntl.h>              //O_CREAT, O_RDWR
+#include <linux/futex.h>        //FUTEX_WAIT, FUTEX_WAKE
+#include <sys/mman.h>           //shm_open, shm_unlink, mmap, munmap
+#include <sys/syscall.h>        //SYS_futex
+#include <sys/stat.h>           //fstat
+#include <unistd.h>             //ftruncate, close, syscall, sysconf
+
+/*
+ * A ring of frames in POSIX shared memory, written by one process and read by any
+ * number of others on the same machine, without copying.
+ *
+ * The producer renders straight into the slot it gets from `begin_write`, and hands
+ * the frame over with `end_write`. Each slot is guarded by a sequence lock: its
+ * counter is odd while the slot is being written, and bumped once the frame in it
+ * is complete. Consumers never block the producer. They read the latest frame in
+ * place, and check with `valid` afterwards that the producer didn't come back around
+ * to the slot while they were at it, which takes falling `slots - 1` frames behind.
+ * Waiting for a new frame is done on a futex in the shared memory, so consumers
+ * sleep rather than poll.
+ */
+class frame_ring {
+public:
+    static constexpr std::uint32_t MAGIC = 0x4d524651;  //"QFRM"
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::uint32_t MAX_SLOTS = 8;
+
+    /**
+     * A frame a consumer is reading, valid until `valid` says otherwise.
+     */
+    struct view {
+        const void* data = nullptr;
+        std::uint64_t frame = 0;
+        std::uint64_t seq = 0;
+        std::uint32_t slot = 0;
+    };
+private:
+    struct alignas(64) slot_state {
+        std::atomic<std::uint64_t> seq;
+        std::atomic<std::uint64_t> frame;
+    };
+
+    struct header {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t width;
+        std::uint32_t height;
+        std::uint32_t pixel_size;
+        std::uint32_t slots;
+        std::uint64_t stride;       //bytes from one slot to the next
+        std::uint64_t offset;       //bytes from the start of the ring to the first slot
+
+        //number of the last frame written, 0 for none
+        alignas(64) std::atomic<std::uint64_t> published;
+        //bumped with every frame, for consumers to wait on
+        std::atomic<std::uint32_t> futex;
+        slot_state slot[MAX_SLOTS];
+    };
+    static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "futex must be 32 bits");
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "shared atomics must be lock free");
+
+    std::string name;
+    void* base = nullptr;
+    std::size_t size = 0;
+    bool owner = false;
+    std::uint64_t writing = 0;
+
+    //prevent copying
+    frame_ring(const frame_ring&) = delete;
+    frame_ring& operator=(const frame_ring&) = delete;
+
+    header* head() const noexcept { return static_cast<header*>(base); }
+
+    unsigned char* slot_data(std::uint32_t slot) const noexcept {
+        return static_cast<unsigned char*>(base) + head()->offset + slot * head()->stride;
+    }
+
+    static std::size_t round_to_page(std::size_t n) noexcept {
+        auto page = sysconf(_SC_PAGESIZE);
+        std::size_t p = page > 0 ? (std::size_t)page : 4096;
+        return (n + p - 1) / p * p;
+    }
+
+    static long futex(std::atomic<std::uint32_t>* word, int op, std::uint32_t value, const timespec* timeout) noexcept {
+        //not FUTEX_PRIVATE_FLAG, the word is shared between processes
+        return syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(word), op, value, timeout, nullptr, 0);
+    }
+    //checks everything consumers rely on, without trusting a single field of the
+    //header, which any process that can open the ring may have written
+    bool validate() const noexcept {
+        auto h = head();
+        if(h->magic != MAGIC) {
+            return false;
+        }
+        //pairs with the fence before `create` writes the magic
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(h->version != VERSION || h->slots < 2 || h->slots > MAX_SLOTS) {
+            return false;
+        }
+        const std::uint64_t frame = (std::uint64_t)h->width * h->height;
+        if(h->pixel_size != 0 && frame > UINT64_MAX / h->pixel_size) {
+            return false;
+        }
+        if(frame * h->pixel_size > h->stride || h->offset < sizeof(header) || h->offset > size) {
+            return false;
+        }
+        //divides rather than multiplies, so that huge strides cannot wrap around
+        if(h->stride > (size - h->offset) / h->slots) {
+            return false;
+        }
+        return true;
+    }
+public:
+    explicit frame_ring() {}
+
+    ~frame_ring() {
+        close();
+    }
+
+    /**
+     * Creates a ring with the given name, such as "/quakeoats", for frames of the given
+     * size, replacing any ring that had the same name. The ring is removed once this
+     * object is closed or destroyed. Returns whether the ring could be created.
+     */
+    bool create(const std::string& shm_name, std::uint32_t width, std::uint32_t height,
+            std::uint32_t pixel_size, std::uint32_t slots = 3) noexcept {
+        close();
+        if(slots < 2 || slots > MAX_SLOTS) {
+            return false;
+        }
+        int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+        if(fd < 0) {
+            return false;
+        }
+        const std::size_t offset = round_to_page(sizeof(header));
+        const std::size_t stride = round_to_page((std::size_t)width * height * pixel_size);
+        const std::size_t total = offset + stride * slots;
+        if(ftruncate(fd, (off_t)total) != 0) {
+            ::close(fd);
+            shm_unlink(shm_name.c_str());
+            return false;
+        }
+        void* p = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(p == MAP_FAILED) {
+            shm_unlink(shm_name.c_str());
+            return false;
+        }
+
+        name = shm_name;
+        base = p;
+        size = total;
+        owner = true;
+        writing = 0;
+
+        //the memory is fresh from ftruncate, so it's all zeroes already, which is a
+        //valid state for every atomic in the header
+        auto h = head();
+        h->width = width;
+        h->height = height;
+        h->pixel_size = pixel_size;
+        h->slots = slots;
+        h->stride = stride;
+        h->offset = offset;
+        h->version = VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        h->magic = MAGIC;
+        return true;
+    }
+
+    /**
+     * Opens an existing ring for reading. Returns whether the ring could be opened and
+     * was made by a compatible producer.
+     */
+    bool open(const std::string& shm_name) noexcept {
+        close();
+        int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || (std::size_t)st.st_size < sizeof(header)) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, (std::size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(p == MAP_FAILED) {
+            return false;
+        }
+
+        base = p;
+        size = (std::size_t)st.st_size;
+        owner = false;
+        if(!validate()) {
+            close();
+            return false;
+        }
+        name = shm_name;
+        return true;
+    }
+
+    /**
+     * Unmaps the ring, removing it if this is the producer.
+     */
+    void close() noexcept {
+        if(base) {
+            munmap(base, size);
+            if(owner) {
+                shm_unlink(name.c_str());
+            }
+        }
+        base = nullptr;
+        size = 0;
+        owner = false;
+        name.clear();
+    }
+
+    bool is_open() const noexcept { return base != nullptr; }
+
+    std::uint32_t width() const noexcept { return head()->width; }
+    std::uint32_t height() const noexcept { return head()->height; }
+    std::uint32_t pixel_size() const noexcept { return head()->pixel_size; }
+    std::uint32_t slots() const noexcept { return head()->slots; }
+
+    /**
+     * Returns the storage for the next frame, which is page aligned. Must be matched by
+     * a call to `end_write` once the frame is complete. Only for the producer.
+     */
+    void* begin_write() noexcept {
+        auto h = head();
+        writing = h->published.load(std::memory_order_relaxed) + 1;
+        const auto slot = (std::uint32_t)(writing % h->slots);
+        auto& state = h->slot[slot];
+
+        state.seq.store(state.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        //the slot has to look busy before any of the frame gets written
+        std::atomic_thread_fence(std::memory_order_release);
+        return slot_data(slot);
+    }
+
+    /**
+     * Publishes the frame written since `begin_write`, waking up every consumer that
+     * waits for one.
+     */
+    void end_write() noexcept {
+        auto h = head();
+        const auto slot = (std::uint32_t)(writing % h->slots);
+        auto& state = h->slot[slot];
+
+        state.frame.store(writing, std::memory_order_relaxed);
+        state.seq.store(state.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        h->published.store(writing, std::memory_order_release);
+
+        h->futex.fetch_add(1, std::memory_order_release);
+        futex(&h->futex, FUTEX_WAKE, INT_MAX, nullptr);
+    }
+
+    /**
+     * Returns the number of the last frame published, 0 if there is none yet.
+     */
+    std::uint64_t published() const noexcept {
+        return head()->published.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Blocks until a frame newer than `frame` gets published, or the timeout passes.
+     * Returns whether there is a newer frame.
+     */
+    bool wait(std::uint64_t frame, std::uint32_t timeout_ms) const noexcept {
+        auto h = head();
+        timespec timeout;
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+        while(true) {
+            const auto word = h->futex.load(std::memory_order_acquire);
+            if(published() > frame) {
+                return true;
+            }
+            if(futex(&h->futex, FUTEX_WAIT, word, &timeout) != 0 && errno == ETIMEDOUT) {
+                return published() > frame;
+            }
+        }
+    }
+
+    /**
+     * Gets the last frame published, to be read in place. Returns false if there is
+     * none, or the producer is too quick to catch it whole.
+     */
+    bool latest(view& v) const noexcept {
+        auto h = head();
+        for(int attempt = 0; attempt < 4; attempt++) {
+            const auto frame = published();
+            if(frame == 0) {
+                return false;
+            }
+            const auto slot = (std::uint32_t)(frame % h->slots);
+            auto& state = h->slot[slot];
+            const auto seq = state.seq.load(std::memory_order_acquire);
+            if(seq % 2 == 0 && state.frame.load(std::memory_order_relaxed) == frame) {
+                v.data = slot_data(slot);
+                v.frame = frame;
+                v.seq = seq;
+                v.slot = slot;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Returns whether a frame obtained from `latest` is still intact. Consumers must
+     * check this after they're done reading the frame, and discard what they read if
+     * it isn't.
+     */
+    bool valid(const view& v) const noexcept {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return head()->slot[v.slot].seq.load(std::memory_order_relaxed) == v.seq;
+    }
+};
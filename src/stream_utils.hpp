@@ -0,0 +1,634 @@
+#pragma once
+
+#include <algorithm>            //std::min, std::max, std::fill
+#include <condition_variable>   //std::condition_variable
+#include <cstddef>              //std::size_t
+#include <cstdint>              //std::uint8_t, std::uint16_t, std::uint32_t, std::uint64_t
+#include <cstring>              //std::memcmp, std::memcpy
+#include <mutex>                //std::mutex, std::lock_guard, std::unique_lock
+#include <thread>               //std::thread
+#include <vector>               //std::vector
+
+#include "thread_utils.hpp"     //thread_pool, wait_group, make_job
+
+#include <arpa/inet.h>          //inet_pton
+#include <netinet/in.h>         //sockaddr_in, htons
+#include <netinet/tcp.h>        //TCP_NODELAY
+#include <poll.h>               //poll
+#include <sys/socket.h>         //socket, bind, listen, accept, send, recv
+#include <unistd.h>             //close
+
+/*
+ * Streaming of frames over TCP, for spectators that don't share memory with the
+ * renderer.
+ *
+ * Frames are split into square tiles. Each tile is compared against the same tile of
+ * the last frame sent, and only the tiles that changed get encoded: their pixels are
+ * XORed with the old ones, which turns everything that stayed the same into runs of
+ * zeroes, and the result is run-length encoded. Comparing a tile that didn't change
+ * is a `memcmp`, so both the bandwidth and most of the encoding cost follow how much
+ * of the frame changed, rather than its resolution. Tiles are encoded in parallel on
+ * the workers of a pool.
+ *
+ * Sending happens on a thread of its own. There are two frame buffers, one being sent
+ * and one being filled, and when the client can't keep up with them, frames are
+ * dropped before they get encoded, rather than queued. Since frames are always
+ * encoded against the last frame that was actually sent, dropping one never breaks
+ * the stream.
+ *
+ * Messages are in the byte order of the host, pixels are 32 bits wide.
+ */
+
+/**
+ * The header of every message, followed by `tiles` tiles, each of which is its index,
+ * the size of its encoding, and the encoding itself, all packed.
+ */
+struct stream_header {
+    static constexpr std::uint32_t MAGIC = 0x52545351;  //"QSTR"
+
+    std::uint32_t magic = MAGIC;
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+    std::uint32_t tile = 0;
+    std::uint64_t frame = 0;
+    std::uint32_t tiles = 0;
+    std::uint32_t bytes = 0;    //bytes that follow the header
+};
+
+namespace stream_detail {
+    //a run of a single word, repeated, rather than a run of words
+    constexpr std::uint16_t RUN = 0x8000;
+    constexpr std::uint16_t MAX_COUNT = 0x7fff;
+
+    /**
+     * Run-length encodes words as they come in. Every packet starts with a 16 bit
+     * count, which is followed by a single word repeated that many times, if the
+     * `RUN` bit is set, or by that many words otherwise.
+     */
+    class rle_writer {
+    private:
+        std::uint8_t* out;
+        std::size_t size = 0;
+        std::size_t literal_at = 0;
+        std::uint16_t literal_count = 0;
+        std::uint32_t run_word = 0;
+        std::uint16_t run_count = 0;
+
+        void put16(std::size_t at, std::uint16_t v) noexcept { std::memcpy(out + at, &v, sizeof(v)); }
+        void put32(std::uint32_t v) noexcept { std::memcpy(out + size, &v, sizeof(v)); size += sizeof(v); }
+
+        void close_literal() noexcept {
+            if(literal_count) {
+                put16(literal_at, literal_count);
+                literal_count = 0;
+            }
+        }
+
+        void flush_run() noexcept {
+            if(run_count >= 2) {
+                close_literal();
+                put16(size, RUN | run_count);
+                size += 2;
+                put32(run_word);
+            } else if(run_count == 1) {
+                if(literal_count == MAX_COUNT) {
+                    close_literal();
+                }
+                if(!literal_count) {
+                    literal_at = size;
+                    size += 2;
+                }
+                put32(run_word);
+                literal_count++;
+            }
+            run_count = 0;
+        }
+    public:
+        /**
+         * Returns the most bytes encoding the given number of words can take.
+         */
+        static constexpr std::size_t bound(std::size_t words) noexcept { return words * 6; }
+
+        explicit rle_writer(std::uint8_t* out): out(out) {}
+
+        void put(std::uint32_t word) noexcept {
+            if(run_count && word == run_word && run_count < MAX_COUNT) {
+                run_count++;
+                return;
+            }
+            flush_run();
+            run_word = word;
+            run_count = 1;
+        }
+
+        /**
+         * Ends the encoding, returning its size in bytes.
+         */
+        std::size_t finish() noexcept {
+            flush_run();
+            close_literal();
+            return size;
+        }
+    };
+
+    //whether every read or write got the whole buffer through
+    inline bool send_all(int fd, const std::uint8_t* data, std::size_t size) noexcept {
+        while(size) {
+            const auto n = ::send(fd, data, size, MSG_NOSIGNAL);
+            if(n <= 0) {
+                return false;
+            }
+            data += n;
+            size -= (std::size_t)n;
+        }
+        return true;
+    }
+
+    inline bool recv_all(int fd, void* data, std::size_t size) noexcept {
+        auto p = static_cast<std::uint8_t*>(data);
+        while(size) {
+            const auto n = ::recv(fd, p, size, 0);
+            if(n <= 0) {
+                return false;
+            }
+            p += n;
+            size -= (std::size_t)n;
+        }
+        return true;
+    }
+}
+
+/**
+ * Streams frames to a single client at a time over TCP. See the top of this file.
+ */
+class frame_streamer {
+public:
+    static constexpr std::uint32_t DEFAULT_TILE = 32;
+
+    struct stats {
+        std::uint64_t sent = 0;         //frames sent
+        std::uint64_t dropped = 0;      //frames dropped because the client was behind
+        std::uint64_t bytes = 0;        //bytes sent
+        std::uint32_t tiles = 0;        //tiles that changed in the last frame encoded
+    };
+private:
+    enum class buffer_state { free, filling, queued, sending };
+
+    struct buffer {
+        std::vector<std::uint8_t> data;
+        std::size_t size = 0;
+        std::uint64_t frame = 0;
+        buffer_state state = buffer_state::free;
+    };
+
+    //the job every worker runs, small enough to never allocate
+    struct encode_job {
+        frame_streamer* self;
+
+        void operator()(std::uint32_t id) {
+            self->encode_tiles(id);
+            self->encoding.done();
+        }
+    };
+
+    const std::uint32_t width;
+    const std::uint32_t height;
+    const std::uint32_t tile;
+    const std::uint32_t tiles_x;
+    const std::uint32_t tiles_y;
+    const std::size_t tile_bound;
+
+    //the frame the client has, as far as the encoder knows
+    std::vector<std::uint32_t> reference;
+    std::vector<std::uint8_t> scratch;
+    //size of the encoding of every tile of the frame being encoded, 0 if unchanged
+    std::vector<std::uint32_t> sizes;
+    buffer buffers[2];
+
+    const std::uint32_t* pixels = nullptr;
+    std::uint32_t stride = 1;
+    wait_group encoding;
+    encode_job job_fn { this };
+    std::uint64_t frame = 0;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    int listen_fd = -1;
+    int client_fd = -1;
+    //bumped whenever a client comes or goes, which invalidates frames being encoded
+    std::uint64_t generation = 0;
+    bool resync = false;
+    bool stop = false;
+    stats counters;
+    std::thread sender;
+
+    //prevent copying
+    frame_streamer(const frame_streamer&) = delete;
+    frame_streamer& operator=(const frame_streamer&) = delete;
+
+    std::uint32_t tile_count() const noexcept { return tiles_x * tiles_y; }
+
+    void encode_tiles(std::uint32_t id) noexcept {
+        for(std::uint32_t t = id; t < tile_count(); t += stride) {
+            const auto x0 = (t % tiles_x) * tile;
+            const auto y0 = (t / tiles_x) * tile;
+            const auto w = std::min(tile, width - x0);
+            const auto h = std::min(tile, height - y0);
+
+            std::uint32_t y = 0;
+            for(; y < h; y++) {
+                const std::size_t at = (std::size_t)(y0 + y) * width + x0;
+                if(std::memcmp(pixels + at, reference.data() + at, w * sizeof(std::uint32_t)) != 0) {
+                    break;
+                }
+            }
+            if(y == h) {
+                sizes[t] = 0;
+                continue;
+            }
+
+            stream_detail::rle_writer out(scratch.data() + t * tile_bound);
+            for(y = 0; y < h; y++) {
+                const std::size_t at = (std::size_t)(y0 + y) * width + x0;
+                for(std::uint32_t x = 0; x < w; x++) {
+                    out.put(pixels[at + x] ^ reference[at + x]);
+                }
+                std::memcpy(reference.data() + at, pixels + at, w * sizeof(std::uint32_t));
+            }
+            sizes[t] = (std::uint32_t)out.finish();
+        }
+    }
+
+    void release_buffers() noexcept {
+        for(auto& b : buffers) {
+            if(b.state != buffer_state::filling) {
+                b.state = buffer_state::free;
+            }
+        }
+    }
+
+    bool accept_client() noexcept {
+        pollfd p = { listen_fd, POLLIN, 0 };
+        if(poll(&p, 1, 100) <= 0) {
+            return false;
+        }
+        const int fd = ::accept(listen_fd, nullptr, nullptr);
+        if(fd < 0) {
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        std::lock_guard<std::mutex> l(lock);
+        client_fd = fd;
+        generation++;
+        resync = true;
+        release_buffers();
+        return true;
+    }
+
+    buffer* next_queued() noexcept {
+        buffer* next = nullptr;
+        for(auto& b : buffers) {
+            if(b.state == buffer_state::queued && (!next || b.frame < next->frame)) {
+                next = &b;
+            }
+        }
+        return next;
+    }
+
+    void run() noexcept {
+        while(true) {
+            int fd;
+            {
+                std::lock_guard<std::mutex> l(lock);
+                if(stop) {
+                    return;
+                }
+                fd = client_fd;
+            }
+            if(fd < 0) {
+                accept_client();
+                continue;
+            }
+
+            buffer* b = nullptr;
+            {
+                std::unique_lock<std::mutex> l(lock);
+                while(!stop && !(b = next_queued())) {
+                    cond.wait(l);
+                }
+                if(stop) {
+                    return;
+                }
+                b->state = buffer_state::sending;
+            }
+
+            const bool ok = stream_detail::send_all(fd, b->data.data(), b->size);
+
+            std::lock_guard<std::mutex> l(lock);
+            if(ok) {
+                counters.sent++;
+                counters.bytes += b->size;
+                b->state = buffer_state::free;
+            } else {
+                ::close(fd);
+                client_fd = -1;
+                generation++;
+                release_buffers();
+            }
+        }
+    }
+public:
+    /**
+     * Creates a streamer for frames of the given size, split into tiles of the given
+     * size. All the memory the streamer needs is allocated here.
+     */
+    explicit frame_streamer(std::uint32_t width, std::uint32_t height, std::uint32_t tile = DEFAULT_TILE)
+        : width(width), height(height), tile(std::max(tile, 1u)),
+          tiles_x((width + this->tile - 1) / this->tile), tiles_y((height + this->tile - 1) / this->tile),
+          tile_bound(stream_detail::rle_writer::bound((std::size_t)this->tile * this->tile)),
+          reference((std::size_t)width * height), scratch(tile_count() * tile_bound), sizes(tile_count()) {
+        for(auto& b : buffers) {
+            b.data.resize(sizeof(stream_header) + tile_count() * (2 * sizeof(std::uint32_t) + tile_bound));
+        }
+    }
+
+    ~frame_streamer() {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            stop = true;
+            //unblocks a send to a client that stopped reading
+            if(client_fd >= 0) {
+                shutdown(client_fd, SHUT_RDWR);
+            }
+        }
+        cond.notify_all();
+        if(sender.joinable()) {
+            sender.join();
+        }
+        if(client_fd >= 0) {
+            ::close(client_fd);
+        }
+        if(listen_fd >= 0) {
+            ::close(listen_fd);
+        }
+    }
+
+    /**
+     * Starts listening for a client on the given address and port, such as
+     * "127.0.0.1" and 0, which picks any free port. Returns whether the streamer is
+     * listening.
+     */
+    bool listen(const char* address, std::uint16_t port) noexcept {
+        if(listen_fd >= 0) {
+            return false;
+        }
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if(inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+            return false;
+        }
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0) {
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(bind(fd, (const sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd, 1) != 0) {
+            ::close(fd);
+            return false;
+        }
+        listen_fd = fd;
+        sender = std::thread([this]() { run(); });
+        return true;
+    }
+
+    /**
+     * Returns the port the streamer listens on, 0 if it doesn't.
+     */
+    std::uint16_t port() const noexcept {
+        sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+        if(listen_fd < 0 || getsockname(listen_fd, (sockaddr*)&addr, &len) != 0) {
+            return 0;
+        }
+        return ntohs(addr.sin_port);
+    }
+
+    /**
+     * Returns whether a client is connected.
+     */
+    bool connected() noexcept {
+        std::lock_guard<std::mutex> l(lock);
+        return client_fd >= 0;
+    }
+
+    stats statistics() noexcept {
+        std::lock_guard<std::mutex> l(lock);
+        return counters;
+    }
+
+    /**
+     * Encodes a frame on the active workers of the pool and queues it for sending.
+     * The frame has `width * height` pixels, row after row, and is only read until
+     * this returns. Returns false if the frame was dropped, because there is no
+     * client, or the client is behind. Must only be called from one thread, outside
+     * of the pool.
+     */
+    bool submit(thread_pool& pool, const void* frame_pixels) noexcept {
+        buffer* b = nullptr;
+        std::uint64_t gen;
+        bool clear = false;
+        {
+            std::lock_guard<std::mutex> l(lock);
+            if(client_fd < 0) {
+                return false;
+            }
+            for(auto& candidate : buffers) {
+                if(candidate.state == buffer_state::free) {
+                    b = &candidate;
+                    break;
+                }
+            }
+            if(!b) {
+                counters.dropped++;
+                return false;
+            }
+            b->state = buffer_state::filling;
+            gen = generation;
+            clear = resync;
+            resync = false;
+        }
+
+        //a new client starts from a black frame, so the first frame it gets is
+        //encoded against one
+        if(clear) {
+            std::fill(reference.begin(), reference.end(), 0);
+        }
+
+        pixels = static_cast<const std::uint32_t*>(frame_pixels);
+        stride = pool.active();
+        encoding.add(stride);
+        for(std::uint32_t i = 0; i < stride; i++) {
+            pool.submit_job_for(i, make_job(job_fn));
+        }
+        encoding.wait();
+
+        //only the tiles that changed get copied into the message
+        stream_header header;
+        header.width = width;
+        header.height = height;
+        header.tile = tile;
+        header.frame = ++frame;
+        std::size_t size = sizeof(header);
+        for(std::uint32_t t = 0; t < tile_count(); t++) {
+            if(!sizes[t]) {
+                continue;
+            }
+            std::memcpy(b->data.data() + size, &t, sizeof(t));
+            std::memcpy(b->data.data() + size + 4, &sizes[t], sizeof(sizes[t]));
+            std::memcpy(b->data.data() + size + 8, scratch.data() + t * tile_bound, sizes[t]);
+            size += 8 + sizes[t];
+            header.tiles++;
+        }
+        header.bytes = (std::uint32_t)(size - sizeof(header));
+        std::memcpy(b->data.data(), &header, sizeof(header));
+
+        std::lock_guard<std::mutex> l(lock);
+        counters.tiles = header.tiles;
+        if(gen != generation) {
+            //the client went away, and the next one gets a fresh start anyway
+            b->state = buffer_state::free;
+            return false;
+        }
+        b->size = size;
+        b->frame = header.frame;
+        b->state = buffer_state::queued;
+        cond.notify_all();
+        return true;
+    }
+};
+
+/**
+ * Connects to a streamer, returning the socket, or -1 if the connection failed.
+ */
+inline int stream_connect(const char* address, std::uint16_t port) noexcept {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        return -1;
+    }
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    if(connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Rebuilds frames on the client's side of a stream.
+ */
+class frame_decoder {
+private:
+    stream_header header;
+    std::vector<std::uint32_t> pixels;
+    std::vector<std::uint8_t> payload;
+
+    bool apply_tile(std::uint32_t t, const std::uint8_t* data, std::size_t size) noexcept {
+        const auto tiles_x = (header.width + header.tile - 1) / header.tile;
+        const auto tiles_y = (header.height + header.tile - 1) / header.tile;
+        if(t >= tiles_x * tiles_y) {
+            return false;
+        }
+        const auto x0 = (t % tiles_x) * header.tile;
+        const auto y0 = (t / tiles_x) * header.tile;
+        const auto w = std::min(header.tile, header.width - x0);
+        const std::size_t count = (std::size_t)w * std::min(header.tile, header.height - y0);
+
+        std::size_t at = 0;
+        std::size_t i = 0;
+        auto apply = [&](std::uint32_t word) {
+            pixels[(std::size_t)(y0 + i / w) * header.width + x0 + i % w] ^= word;
+            i++;
+        };
+        while(at + 2 <= size) {
+            std::uint16_t packet;
+            std::memcpy(&packet, data + at, 2);
+            at += 2;
+            const std::size_t n = packet & stream_detail::MAX_COUNT;
+            const bool run = packet & stream_detail::RUN;
+            if(i + n > count || at + (run ? 4 : 4 * n) > size) {
+                return false;
+            }
+            std::uint32_t word = 0;
+            for(std::size_t k = 0; k < n; k++) {
+                if(!run || k == 0) {
+                    std::memcpy(&word, data + at, 4);
+                    at += 4;
+                }
+                apply(word);
+            }
+        }
+        return at == size && i == count;
+    }
+public:
+    explicit frame_decoder() {}
+
+    /**
+     * Applies a message to the frame. Returns false if the message is malformed, in
+     * which case the frame is left in an undefined state.
+     */
+    bool apply(const stream_header& h, const std::uint8_t* data) {
+        if(h.magic != stream_header::MAGIC || h.tile == 0) {
+            return false;
+        }
+        if(h.width != header.width || h.height != header.height) {
+            pixels.assign((std::size_t)h.width * h.height, 0);
+        }
+        header = h;
+
+        std::size_t at = 0;
+        for(std::uint32_t k = 0; k < h.tiles; k++) {
+            std::uint32_t t, size;
+            if(at + 8 > h.bytes) {
+                return false;
+            }
+            std::memcpy(&t, data + at, 4);
+            std::memcpy(&size, data + at + 4, 4);
+            at += 8;
+            if(at + size > h.bytes || !apply_tile(t, data + at, size)) {
+                return false;
+            }
+            at += size;
+        }
+        return at == h.bytes;
+    }
+
+    /**
+     * Reads the next message from the socket and applies it. Returns false once the
+     * stream ends, or if it is malformed.
+     */
+    bool receive(int fd) {
+        stream_header h;
+        if(!stream_detail::recv_all(fd, &h, sizeof(h)) || h.magic != stream_header::MAGIC) {
+            return false;
+        }
+        if(payload.size() < h.bytes) {
+            payload.resize(h.bytes);
+        }
+        return stream_detail::recv_all(fd, payload.data(), h.bytes) && apply(h, payload.data());
+    }
+
+    std::uint32_t width() const noexcept { return header.width; }
+    std::uint32_t height() const noexcept { return header.height; }
+    std::uint64_t frame() const noexcept { return header.frame; }
+    std::uint32_t tiles() const noexcept { return header.tiles; }
+    const std::uint32_t* data() const noexcept { return pixels.data(); }
+};
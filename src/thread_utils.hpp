@@ -1,9 +1,11 @@
 #pragma once
 
+#include <algorithm>            //std::min, std::max
 #include <atomic>               //std::atomic, std::memory_order_*
+#include <chrono>               //std::chrono::steady_clock, std::chrono::nanoseconds
 #include <condition_variable>   //std::condition_variable
+#include <cstddef>              //std::size_t
 #include <cstdint>              //std::uint32_t
-#include <deque>                //std::deque
 #include <functional>           //std::function
 #include <future>               //std::future, std::packaged_task
 #include <initializer_list>     //std::initializer_list
@@ -14,10 +16,63 @@
 #include <thread>               //std::thread
 #include <vector>               //std::vector
 
+/**
+ * A double-ended queue backed by a ring buffer. Unlike `std::deque`, which allocates
+ * and frees blocks as elements flow through it, this only allocates when it has to
+ * grow past its capacity, so a queue that sees the same traffic every frame stops
+ * touching the heap once warm.
+ */
+template<typename T>
+class ring_queue {
+private:
+    std::vector<T> buf;
+    std::size_t head = 0;
+    std::size_t count = 0;
+
+    //capacity is always a power of two, so indices can be masked
+    std::size_t index(std::size_t i) const noexcept {
+        return (head + i) & (buf.size() - 1);
+    }
+
+    void grow() {
+        std::vector<T> next(buf.empty() ? 16 : buf.size() * 2);
+        for(std::size_t i = 0; i < count; i++) {
+            next[i] = std::move(buf[index(i)]);
+        }
+        buf = std::move(next);
+        head = 0;
+    }
+public:
+    bool empty() const noexcept { return count == 0; }
+    std::size_t size() const noexcept { return count; }
+
+    T& front() noexcept { return buf[head]; }
+    T& back() noexcept { return buf[index(count - 1)]; }
+
+    void push_back(T&& t) {
+        if(count == buf.size()) {
+            grow();
+        }
+        buf[index(count)] = std::move(t);
+        count++;
+    }
+
+    void pop_front() noexcept {
+        buf[head] = T();
+        head = index(1);
+        count--;
+    }
+
+    void pop_back() noexcept {
+        buf[index(count - 1)] = T();
+        count--;
+    }
+};
+
 template<typename T>
 class work_queue {
 private:
-    std::deque<T> q;
+    ring_queue<T> q;
     std::mutex lock;
     std::condition_variable cond;
 
@@ -87,6 +142,152 @@ using WorkerTask = std::packaged_task<void(std::uint32_t)>;
 template<typename T>
 using Task = std::function<T(std::uint32_t)>;
 
+/**
+ * Counts pending units of work, allowing a thread to wait for all of them to be done.
+ * This is the allocation-free counterpart to waiting on a vector of futures.
+ */
+class wait_group {
+private:
+    std::mutex lock;
+    std::condition_variable cond;
+    std::uint32_t pending = 0;
+
+    //prevent copying
+    wait_group(const wait_group&) = delete;
+    wait_group& operator=(const wait_group&) = delete;
+public:
+    explicit wait_group() {}
+
+    /**
+     * Adds the given number of units of work to the group.
+     */
+    void add(std::uint32_t n = 1) noexcept {
+        std::lock_guard<std::mutex> l(lock);
+        pending += n;
+    }
+
+    /**
+     * Marks one unit of work in the group as done.
+     */
+    void done() noexcept {
+        std::lock_guard<std::mutex> l(lock);
+        if(--pending == 0) {
+            cond.notify_all();
+        }
+    }
+
+    /**
+     * Blocks until all the units of work in the group are done.
+     */
+    void wait() noexcept {
+        std::unique_lock<std::mutex> l(lock);
+        while(pending != 0) {
+            cond.wait(l);
+        }
+    }
+};
+
+/**
+ * A flag that tells work it isn't wanted anymore. Work doesn't get interrupted when
+ * the token is cancelled, it has to check the token itself, either before it starts
+ * or at points where it's safe for it to stop.
+ */
+class cancellation_token {
+private:
+    std::atomic<bool> flag { false };
+
+    //prevent copying
+    cancellation_token(const cancellation_token&) = delete;
+    cancellation_token& operator=(const cancellation_token&) = delete;
+public:
+    explicit cancellation_token() {}
+
+    /**
+     * Marks the token as cancelled. Safe to call from any thread.
+     */
+    void cancel() noexcept { flag.store(true, std::memory_order_release); }
+
+    /**
+     * Returns whether the token has been cancelled since the last reset.
+     */
+    bool cancelled() const noexcept { return flag.load(std::memory_order_acquire); }
+
+    /**
+     * Clears the token, so that it can be used for new work.
+     */
+    void reset() noexcept { flag.store(false, std::memory_order_release); }
+};
+
+/**
+ * A wait group for jobs that can be dropped as a whole. Jobs submitted to the pool
+ * along with a group are marked done by the pool itself, once they have run, and
+ * don't run at all if the group was cancelled by the time a worker gets to them, so
+ * cancelling a group frees the workers from its queued jobs right away. Jobs that
+ * take long should poll `cancelled()` as they go.
+ *
+ * The group has to be reset before it can be used again after being cancelled, which
+ * should only be done when no work in it is pending.
+ */
+class task_group : public wait_group {
+private:
+    cancellation_token token;
+public:
+    explicit task_group() {}
+
+    void cancel() noexcept { token.cancel(); }
+    bool cancelled() const noexcept { return token.cancelled(); }
+    void reset() noexcept { token.reset(); }
+};
+
+/**
+ * A task whose storage is owned by the caller, rather than by the pool. Unlike
+ * submitting a `Task`, submitting a job never allocates, which makes jobs suitable
+ * for work that gets submitted over and over again, such as once per frame.
+ *
+ * The callable the job refers to must stay alive until the job has run. Jobs
+ * don't have futures, use a `wait_group` to wait for them instead, or a `task_group`
+ * when they might have to be cancelled.
+ */
+struct job {
+    void (*run)(void*, std::uint32_t) = nullptr;
+    void* context = nullptr;
+    task_group* group = nullptr;
+};
+
+/**
+ * Creates a job that calls the given callable with the id of the thread it runs in.
+ */
+template<typename F>
+job make_job(F& f) noexcept {
+    job j;
+    j.run = [](void* context, std::uint32_t id) {
+        (*static_cast<F*>(context))(id);
+    };
+    j.context = &f;
+    return j;
+}
+
+/**
+ * Creates a job that belongs to the given group. The caller must have added the
+ * job to the group before submitting it, but the job must not mark itself as done,
+ * the pool does it.
+ */
+template<typename F>
+job make_job(F& f, task_group& group) noexcept {
+    job j = make_job(f);
+    j.group = &group;
+    return j;
+}
+
+/**
+ * Anything that can be queued into a worker, either a task or a job. Tasks that
+ * belong to a group keep it in the job, which has no function in that case.
+ */
+struct work_item {
+    WorkerTask task;
+    job j;
+};
+
 /**
  * Creates a task from a function which takes no arguments, ignoring the
  * provided thread id.
@@ -99,16 +300,205 @@ Task<T> make_task(std::function<T()> f) {
     };
 }
 
+/**
+ * A timer that runs a task at a deadline, and then optionally every given interval.
+ * Times are kept in ticks of whatever length the owner of the wheel picks.
+ */
+struct timer {
+    std::uint64_t id = 0;
+    std::uint64_t deadline = 0;     //in ticks
+    std::uint64_t time = 0;         //in nanoseconds, for the owner to compute deadlines
+    std::uint64_t period = 0;       //in nanoseconds, 0 for timers that only run once
+    bool on_timer_thread = false;   //run by the thread driving the timers, not a worker
+    Task<void> task;
+
+    //owned by the wheel the timer is in
+    timer* prev = nullptr;
+    timer* next = nullptr;
+    std::uint32_t level = 0;
+    std::uint32_t slot = 0;
+
+    //the wheel holds one reference while the timer is scheduled, and every run
+    //that is still queued or running holds another
+    std::atomic<std::uint32_t> refs { 1 };
+    std::atomic<bool> running { false };
+
+    void release() noexcept {
+        if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+};
+
+/**
+ * A hierarchical timer wheel. Each level has a slot for every one of the next 64
+ * ticks of that level, with a tick of a level lasting as long as all of the slots
+ * of the level below. Timers go into the lowest level that reaches their deadline,
+ * and move down one level each time the wheel gets to their slot, so scheduling and
+ * cancelling a timer take constant time, no matter how many timers there are.
+ *
+ * Timers further away than the top level reaches get parked in its furthest slot
+ * until they're close enough. The wheel itself isn't synchronized.
+ */
+class timer_wheel {
+public:
+    static constexpr std::uint32_t LEVEL_BITS = 6;
+    static constexpr std::uint32_t SLOTS = 1u << LEVEL_BITS;
+    static constexpr std::uint32_t LEVELS = 4;
+private:
+    timer* slots[LEVELS][SLOTS] = {};
+    std::uint64_t current = 0;
+    std::size_t count = 0;
+
+    //prevent copying
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+
+    static std::uint32_t slot_of(std::uint64_t tick, std::uint32_t level) noexcept {
+        return (tick >> (level * LEVEL_BITS)) & (SLOTS - 1);
+    }
+
+    void link(timer* t, std::uint32_t level, std::uint32_t slot) noexcept {
+        t->level = level;
+        t->slot = slot;
+        t->prev = nullptr;
+        t->next = slots[level][slot];
+        if(t->next) {
+            t->next->prev = t;
+        }
+        slots[level][slot] = t;
+    }
+
+    //move all of the timers in a slot down to the levels their deadlines are in now
+    void cascade(std::uint32_t level, std::uint32_t slot) noexcept {
+        auto t = slots[level][slot];
+        slots[level][slot] = nullptr;
+        while(t) {
+            auto next = t->next;
+            count--;
+            insert(t);
+            t = next;
+        }
+    }
+public:
+    explicit timer_wheel() {}
+
+    /**
+     * Returns the tick the wheel is at.
+     */
+    std::uint64_t now() const noexcept { return current; }
+
+    /**
+     * Returns the number of timers in the wheel.
+     */
+    std::size_t size() const noexcept { return count; }
+
+    /**
+     * Adds a timer to the wheel. Timers whose deadline has already passed fire on
+     * the next tick.
+     */
+    void insert(timer* t) noexcept {
+        if(t->deadline <= current) {
+            t->deadline = current + 1;
+        }
+        const auto delta = t->deadline - current;
+
+        std::uint32_t level = 0;
+        while(level + 1 < LEVELS && delta >= (std::uint64_t(1) << ((level + 1) * LEVEL_BITS))) {
+            level++;
+        }
+        auto at = t->deadline;
+        if(delta >= (std::uint64_t(1) << (LEVELS * LEVEL_BITS))) {
+            at = current + (std::uint64_t(1) << (LEVELS * LEVEL_BITS)) - 1;
+        }
+        link(t, level, slot_of(at, level));
+        count++;
+    }
+
+    /**
+     * Removes a timer from the wheel. The timer must be in the wheel.
+     */
+    void remove(timer* t) noexcept {
+        if(t->prev) {
+            t->prev->next = t->next;
+        } else {
+            slots[t->level][t->slot] = t->next;
+        }
+        if(t->next) {
+            t->next->prev = t->prev;
+        }
+        t->prev = nullptr;
+        t->next = nullptr;
+        count--;
+    }
+
+    /**
+     * Moves the wheel forward to the given tick, removing every timer whose deadline
+     * is up to it and calling `fire` with it, in order of deadline.
+     */
+    template<typename F>
+    void advance(std::uint64_t to, F&& fire) {
+        while(current < to) {
+            if(count == 0) {
+                current = to;
+                break;
+            }
+            current++;
+            for(std::uint32_t level = 1; level < LEVELS; level++) {
+                if(current & ((std::uint64_t(1) << (level * LEVEL_BITS)) - 1)) {
+                    break;
+                }
+                cascade(level, slot_of(current, level));
+            }
+
+            auto& slot = slots[0][slot_of(current, 0)];
+            while(auto t = slot) {
+                slot = t->next;
+                if(slot) {
+                    slot->prev = nullptr;
+                }
+                t->next = nullptr;
+                count--;
+                fire(t);
+            }
+        }
+    }
+
+    /**
+     * Returns the next tick at which the wheel has something to do, either firing
+     * timers or moving them down a level, if it has any timers at all.
+     */
+    std::optional<std::uint64_t> next_tick() const noexcept {
+        std::optional<std::uint64_t> best;
+        for(std::uint32_t level = 0; level < LEVELS; level++) {
+            const auto shift = level * LEVEL_BITS;
+            const auto base = current >> shift;
+            for(std::uint64_t i = 1; i <= SLOTS; i++) {
+                if(slots[level][(base + i) & (SLOTS - 1)]) {
+                    const auto tick = (base + i) << shift;
+                    if(!best || tick < *best) {
+                        best = tick;
+                    }
+                    break;
+                }
+            }
+        }
+        return best;
+    }
+};
+
 class thread_pool;
 class thread_pool_worker {
 private:
     friend class thread_pool;
 
     const std::uint32_t id;
-    work_queue<WorkerTask> external_tasks;
-    std::deque<WorkerTask> local_tasks;
+    work_queue<work_item> external_tasks;
+    ring_queue<work_item> local_tasks;
     std::thread thr;
     std::promise<std::thread::id> thread_id_promise;
+    //total time spent running work, in nanoseconds, only ever written by the worker
+    std::atomic<std::uint64_t> busy { 0 };
 
     //prevent copying
     thread_pool_worker(const thread_pool_worker&) = delete;
@@ -118,11 +508,27 @@ private:
         thread_id_promise.set_value(std::this_thread::get_id());
         while(1) {
             auto t = get_next_task();
-            if(!t.valid()) break;
-            t(id);
+            if(!t.j.run && !t.task.valid()) break;
+
+            const auto begin = std::chrono::steady_clock::now();
+            auto group = t.j.group;
+            if(!group || !group->cancelled()) {
+                if(t.j.run) {
+                    t.j.run(t.j.context, id);
+                } else {
+                    t.task(id);
+                }
+            }
+            //a dropped task breaks its promise, so its future throws `std::future_error`
+            if(group) {
+                group->done();
+            }
+            const auto end = std::chrono::steady_clock::now();
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+            busy.store(busy.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
         }
     }
-    WorkerTask get_next_task() {
+    work_item get_next_task() {
         if(!local_tasks.empty()) {
             auto t = std::move(local_tasks.front());
             local_tasks.pop_front();
@@ -132,11 +538,15 @@ private:
     }
 
     void queue_local_task(WorkerTask&& t) {
-        local_tasks.push_back(std::move(t));
+        local_tasks.push_back(work_item { std::move(t), {} });
     }
     
-    void queue_task(WorkerTask&& t) {
-        external_tasks.enqueue(std::move(t));
+    void queue_task(WorkerTask&& t, task_group* group = nullptr) {
+        external_tasks.enqueue(work_item { std::move(t), job { nullptr, nullptr, group } });
+    }
+
+    void queue_job(job j) {
+        external_tasks.enqueue(work_item { {}, j });
     }
 public:
     explicit thread_pool_worker(std::uint32_t _id): id(_id) {
@@ -149,35 +559,205 @@ public:
     }
 };
 
+/**
+ * A pool of worker threads. The pool always holds `max_size()` workers, of which only
+ * the first `active()` get handed work by `submit_job` and `submit_task`; the rest are
+ * parked, sleeping on their queues without ever waking up. Calling `adapt` once in a
+ * while (such as once per frame) moves the number of active workers between
+ * `min_size()` and `max_size()`, depending on how busy the workers have been.
+ *
+ * The pool can also run tasks at given times or intervals, see `schedule_at` and
+ * `schedule_every`.
+ */
 class thread_pool {
 private:
     std::uint32_t worker_count;
+    std::uint32_t min_count;
+    std::atomic<std::uint32_t> active_count;
     std::atomic<std::uint32_t> next_worker;
     std::vector<std::unique_ptr<thread_pool_worker>> workers;
     std::map<std::thread::id, std::uint32_t> worker_ids;
 
+    //state of the last call to adapt
+    std::chrono::steady_clock::time_point last_adapt;
+    std::uint64_t last_busy = 0;
+    double last_utilization = 0.0;
+
+    //timers, driven by a thread that only gets started along with the first timer
+    std::chrono::steady_clock::time_point timer_epoch;
+    timer_wheel timers;
+    std::map<std::uint64_t, timer*> timer_ids;
+    std::vector<timer*> timers_due;
+    std::uint64_t next_timer_id = 1;
+    std::mutex timer_lock;
+    std::condition_variable timer_cond;
+    std::thread timer_thread;
+    bool timer_stop = false;
+
     //prevent copying
     thread_pool(const thread_pool&) = delete;
     thread_pool& operator=(const thread_pool&) = delete;
     
     std::uint32_t get_next_worker() {
-        auto id = next_worker.fetch_add(1, std::memory_order_acq_rel) % worker_count;
+        auto id = next_worker.fetch_add(1, std::memory_order_acq_rel) % active();
         return id;
     }
 
+    std::uint64_t nanoseconds_since_epoch(std::chrono::steady_clock::time_point t) const noexcept {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t - timer_epoch).count();
+        return ns > 0 ? (std::uint64_t)ns : 0;
+    }
+
+    //deadlines are rounded up to the next tick, so that timers never fire early
+    static std::uint64_t tick_of(std::uint64_t ns) noexcept {
+        return (ns + TIMER_TICK.count() - 1) / TIMER_TICK.count();
+    }
+
+    static void run_timer(void* context, std::uint32_t id) {
+        auto t = static_cast<timer*>(context);
+        t->task(id);
+        t->running.store(false, std::memory_order_release);
+        t->release();
+    }
+
+    //called with the timer lock held, for every timer the wheel fires
+    void fire_timer(timer* t) {
+        if(t->period) {
+            //keep periodic timers in phase, skipping any runs they missed
+            const auto now = timers.now() * TIMER_TICK.count();
+            t->time += t->period;
+            if(t->time < now) {
+                t->time += (now - t->time) / t->period * t->period + t->period;
+            }
+            t->deadline = tick_of(t->time);
+            timers.insert(t);
+
+            //a run that is still going swallows the next one
+            if(t->running.exchange(true, std::memory_order_acq_rel)) {
+                return;
+            }
+            t->refs.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            //the reference the wheel held goes to the run
+            timer_ids.erase(t->id);
+            t->running.store(true, std::memory_order_release);
+        }
+        timers_due.push_back(t);
+    }
+
+    void run_timers() {
+        std::unique_lock<std::mutex> l(timer_lock);
+        while(!timer_stop) {
+            const auto now = nanoseconds_since_epoch(std::chrono::steady_clock::now()) / TIMER_TICK.count();
+            timers.advance(now, [this](timer* t) { fire_timer(t); });
+            if(!timers_due.empty()) {
+                l.unlock();
+                for(auto t : timers_due) {
+                    if(t->on_timer_thread) {
+                        run_timer(t, worker_count);
+                    } else {
+                        submit_job(job { &thread_pool::run_timer, t, nullptr });
+                    }
+                }
+                l.lock();
+                timers_due.clear();
+                continue;
+            }
+            if(auto next = timers.next_tick()) {
+                timer_cond.wait_until(l, timer_epoch + *next * TIMER_TICK);
+            } else {
+                timer_cond.wait(l);
+            }
+        }
+    }
+
+    std::uint64_t schedule_timer(std::uint64_t time, std::uint64_t period, Task<void> t, bool on_timer_thread) {
+        auto tm = new timer;
+        tm->time = time;
+        tm->period = period;
+        tm->on_timer_thread = on_timer_thread;
+        tm->deadline = tick_of(time);
+        tm->task = std::move(t);
+
+        std::lock_guard<std::mutex> l(timer_lock);
+        tm->id = next_timer_id++;
+        timers.insert(tm);
+        timer_ids.insert({tm->id, tm});
+        //no more timers can fall due at once than there are, so make room for all of
+        //them here, which allocates anyway, rather than on the timer thread as they fire
+        timers_due.reserve(timer_ids.size());
+        if(!timer_thread.joinable()) {
+            timer_thread = std::thread(&thread_pool::run_timers, this);
+        }
+        timer_cond.notify_one();
+        return tm->id;
+    }
+
+    std::uint64_t total_busy() const noexcept {
+        std::uint64_t busy = 0;
+        for(const auto& w : workers) {
+            busy += w->busy.load(std::memory_order_relaxed);
+        }
+        return busy;
+    }
+
 public:
-    explicit thread_pool(std::uint32_t size): worker_count(size) {
+    /**
+     * Fraction of the frame budget the active workers should be kept busy for. Leaving
+     * some headroom keeps a frame that is a bit heavier than the last from going over.
+     */
+    static constexpr double TARGET_LOAD = 0.75;
+
+    /**
+     * Resolution of the timers. Timers fire on the first tick at or after their
+     * deadline, and then as soon as the timer thread gets woken up.
+     */
+    static constexpr std::chrono::nanoseconds TIMER_TICK { 100000 };
+
+    using timer_id = std::uint64_t;
+
+    /**
+     * Creates a pool with a fixed number of workers, all of them active.
+     */
+    explicit thread_pool(std::uint32_t size): thread_pool(size, size) {}
+
+    /**
+     * Creates a pool with `max` workers, starting with `min` of them active. The number
+     * of active workers never goes out of the [min, max] range.
+     */
+    explicit thread_pool(std::uint32_t min, std::uint32_t max)
+        : worker_count(std::max(max, 1u)), min_count(std::clamp(min, 1u, std::max(max, 1u))) {
+        active_count.store(min_count);
         next_worker.store(0);
-        workers.reserve(size);
-        for(std::uint32_t i = 0; i < size; i++) {
+        workers.reserve(worker_count);
+        for(std::uint32_t i = 0; i < worker_count; i++) {
             workers.push_back(std::make_unique<thread_pool_worker>(i));
         }
-        for(std::uint32_t i = 0; i < size; i++) {
+        for(std::uint32_t i = 0; i < worker_count; i++) {
             auto future = workers[i]->thread_id_promise.get_future();
             future.wait();
             const auto id = future.get();
             worker_ids.insert({id, i});
         }
+        last_adapt = std::chrono::steady_clock::now();
+        timer_epoch = last_adapt;
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> l(timer_lock);
+            timer_stop = true;
+        }
+        timer_cond.notify_one();
+        if(timer_thread.joinable()) {
+            timer_thread.join();
+        }
+        //runs already queued still hold on to their timers
+        for(auto& [id, t] : timer_ids) {
+            (void)id;
+            timers.remove(t);
+            t->release();
+        }
     }
 
     /**
@@ -200,10 +780,65 @@ public:
     }
 
     /**
-     * Returns the number of threads in this pool.
+     * Returns the number of threads in this pool, counting the parked ones.
      */
     std::uint32_t size() const noexcept { return worker_count; }
 
+    /**
+     * Returns the number of threads work gets spread over. These are always the
+     * threads in the range [0, active()).
+     */
+    std::uint32_t active() const noexcept { return active_count.load(std::memory_order_acquire); }
+
+    /**
+     * Returns the bounds on the number of active threads.
+     */
+    std::uint32_t min_size() const noexcept { return min_count; }
+    std::uint32_t max_size() const noexcept { return worker_count; }
+
+    /**
+     * Returns how busy the active threads were between the last two calls to `adapt`,
+     * from 0 (idle) to 1 (busy all of the time).
+     */
+    double utilization() const noexcept { return last_utilization; }
+
+    /**
+     * Changes the number of active threads based on how much work the pool ran since
+     * the last call, returning the new number of active threads. The `budget` is how
+     * long that work is allowed to take, such as the length of a frame.
+     *
+     * The pool aims for as few threads as it takes to get the work done in a
+     * `TARGET_LOAD` fraction of the budget. It grows to that number right away, so
+     * that a heavy frame gets help by the next one, but only shrinks by one thread
+     * per call, so that a single light frame doesn't park half the pool.
+     *
+     * This must only be called from one thread at a time, outside of the pool.
+     */
+    std::uint32_t adapt(std::chrono::nanoseconds budget) noexcept {
+        const auto now = std::chrono::steady_clock::now();
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_adapt).count();
+        const auto busy = total_busy();
+        const auto work = busy - last_busy;
+        last_adapt = now;
+        last_busy = busy;
+
+        const auto current = active();
+        last_utilization = elapsed > 0 ? std::min(1.0, (double)work / ((double)elapsed * current)) : 0.0;
+
+        const double capacity = std::max(1.0, (double)budget.count() * TARGET_LOAD);
+        const auto wanted = (std::uint32_t)std::min((double)worker_count, (double)work / capacity + 1.0);
+
+        auto next = current;
+        if(wanted > current) {
+            next = wanted;
+        } else if(wanted < current) {
+            next = current - 1;
+        }
+        next = std::clamp(next, min_count, worker_count);
+        active_count.store(next, std::memory_order_release);
+        return next;
+    }
+
     /**
      * Submits a task to a given thread. The provided thread number must be
      * in the range [0, thread_count).
@@ -216,6 +851,44 @@ public:
         return f;
     }
 
+    /**
+     * Submits a task that belongs to the given group to a given thread. The task must
+     * have been added to the group, and is marked as done by the pool. If the group
+     * gets cancelled before the task runs, the task is dropped and its future throws
+     * `std::future_error`.
+     */
+    template<typename T>
+    std::future<T> submit_task_for(std::uint32_t tid, Task<T> t, task_group& group) noexcept {
+        auto p = std::packaged_task<T(std::uint32_t)>(t);
+        auto f = p.get_future();
+        workers[tid]->queue_task(std::packaged_task<void(std::uint32_t)>(std::move(p)), &group);
+        return f;
+    }
+
+    /**
+     * Submits a task that belongs to the given group to any of the pool's active
+     * threads. See `submit_task_for`.
+     */
+    template<typename T>
+    std::future<T> submit_task(Task<T> t, task_group& group) noexcept {
+        return submit_task_for<T>(get_next_worker(), t, group);
+    }
+
+    /**
+     * Submits a job to a given thread. The provided thread number must be
+     * in the range [0, thread_count).
+     */
+    void submit_job_for(std::uint32_t tid, job j) noexcept {
+        workers[tid]->queue_job(j);
+    }
+
+    /**
+     * Submits a job to any of the pool's active threads.
+     */
+    void submit_job(job j) noexcept {
+        submit_job_for(get_next_worker(), j);
+    }
+
     /**
      * Submits a task to the pool. If the caller is already running in one of
      * the pool's threads, the task is added to a local queue, which means it'll
@@ -254,7 +927,7 @@ public:
             std::uint32_t thread = current;
             for(auto t : tasks) {
                 res.emplace_back(submit_task(t, thread == current));
-                thread = (thread + 1) % size();
+                thread = (thread + 1) % active();
             }
         } else {
             for(auto t : tasks) {
@@ -264,6 +937,57 @@ public:
         return res;
     }
 
+    /**
+     * Runs a task on any of the pool's active threads once the given time comes. All
+     * of the pool's timers share a single thread, which gets started along with the
+     * first timer. Returns an id the timer can be cancelled with.
+     */
+    timer_id schedule_at(std::chrono::steady_clock::time_point deadline, Task<void> t) {
+        return schedule_timer(nanoseconds_since_epoch(deadline), 0, std::move(t), false);
+    }
+
+    /**
+     * Runs a task on any of the pool's active threads once the given delay passes.
+     */
+    timer_id schedule_after(std::chrono::nanoseconds delay, Task<void> t) {
+        return schedule_at(std::chrono::steady_clock::now() + delay, std::move(t));
+    }
+
+    /**
+     * Runs a task on any of the pool's active threads every given interval, starting
+     * one interval from now, until the timer gets cancelled. Runs are scheduled from
+     * the time the timer was created, rather than from the last run, so they don't
+     * drift. If a run is still going when the next one is due, or the timer thread
+     * falls behind, the runs that can't be made get skipped.
+     *
+     * If `on_timer_thread` is set, the task is run by the timer thread itself, with an
+     * ID of `max_size()`, rather than by a worker, so it never holds up the work on the
+     * pool. Other timers wait for it, so this is meant for short tasks that shouldn't
+     * take a worker away, such as writing out a log.
+     */
+    timer_id schedule_every(std::chrono::nanoseconds interval, Task<void> t, bool on_timer_thread = false) {
+        const auto period = std::max<std::uint64_t>(interval.count(), 1);
+        const auto now = nanoseconds_since_epoch(std::chrono::steady_clock::now());
+        return schedule_timer(now + period, period, std::move(t), on_timer_thread);
+    }
+
+    /**
+     * Cancels a timer, returning whether it was still scheduled. A run of the timer
+     * that has already started or been queued still goes on.
+     */
+    bool cancel_timer(timer_id id) {
+        std::lock_guard<std::mutex> l(timer_lock);
+        auto it = timer_ids.find(id);
+        if(it == timer_ids.end()) {
+            return false;
+        }
+        auto t = it->second;
+        timer_ids.erase(it);
+        timers.remove(t);
+        t->release();
+        return true;
+    }
+
     /**
      * Returns the ID of the current thread, if running inside the pool.
      */
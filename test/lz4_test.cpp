@@ -0,0 +1,180 @@
+//compile with `c++ -I"src" -std=c++17 test/lz4_test.cpp`
+#include "lz4_utils.hpp"
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using bytes = std::vector<std::uint8_t>;
+
+//the greedy compressor `tools/map` falls back on when there's no lz4 module, such
+//that the blocks it writes get checked against the decompressor
+bytes compress(const bytes& data) {
+    const std::size_t MIN_MATCH = 4, MAX_OFFSET = 0xffff, LAST_LITERALS = 5, MATCH_LIMIT = 12;
+
+    bytes out;
+    auto length = [&](std::size_t n) {
+        for(; n >= 255; n -= 255) {
+            out.push_back(255);
+        }
+        out.push_back((std::uint8_t)n);
+    };
+    auto sequence = [&](std::size_t first, std::size_t last, std::size_t match, std::size_t offset) {
+        const std::size_t literals = last - first;
+        const std::size_t ml = match ? match - MIN_MATCH : 0;
+        out.push_back((std::uint8_t)(std::min<std::size_t>(literals, 15) << 4 | std::min<std::size_t>(ml, 15)));
+        if(literals >= 15) {
+            length(literals - 15);
+        }
+        out.insert(out.end(), data.begin() + first, data.begin() + last);
+        if(match) {
+            out.push_back((std::uint8_t)offset);
+            out.push_back((std::uint8_t)(offset >> 8));
+            if(ml >= 15) {
+                length(ml - 15);
+            }
+        }
+    };
+
+    std::unordered_map<std::uint32_t, std::size_t> seen;
+    std::size_t anchor = 0;
+    std::size_t i = 0;
+    const std::size_t end = data.size();
+    while(i + MATCH_LIMIT <= end) {
+        std::uint32_t key;
+        std::memcpy(&key, data.data() + i, 4);
+        auto found = seen.find(key);
+        const bool hit = found != seen.end() && i - found->second <= MAX_OFFSET;
+        const std::size_t j = hit ? found->second : 0;
+        seen[key] = i;
+        if(!hit) {
+            i++;
+            continue;
+        }
+
+        std::size_t match = MIN_MATCH;
+        const std::size_t limit = end - LAST_LITERALS - i;
+        while(match < limit && data[j + match] == data[i + match]) {
+            match++;
+        }
+        sequence(anchor, i, match, i - j);
+        i += match;
+        anchor = i;
+    }
+    sequence(anchor, end, 0, 0);
+    return out;
+}
+
+bool decompresses_to(const bytes& block, const bytes& expected) {
+    bytes out(expected.size());
+    return lz4_decompress(block.data(), block.size(), out.data(), out.size()) && out == expected;
+}
+
+int main() {
+    std::mt19937 random(125);
+    auto noise = [&](std::size_t n) {
+        bytes b(n);
+        for(auto& v : b) {
+            v = (std::uint8_t)random();
+        }
+        return b;
+    };
+    auto pattern = [](std::size_t n, std::size_t period) {
+        bytes b(n);
+        for(std::size_t i = 0; i < n; i++) {
+            b[i] = (std::uint8_t)(i % period * 37);
+        }
+        return b;
+    };
+
+    //literals only, short and long matches, matches overlapping what they write,
+    //lengths that need extra bytes, and offsets as far back as they go
+    std::vector<bytes> cases;
+    for(std::size_t n : { 0, 1, 4, 11, 12, 13, 16, 300 }) {
+        cases.push_back(noise(n));
+    }
+    for(std::size_t n : { 12, 13, 20, 19 + 255, 19 + 255 * 3, 100000 }) {
+        cases.push_back(bytes(n, 0));
+    }
+    for(std::size_t period : { 1, 2, 3, 4, 7, 16, 255 }) {
+        cases.push_back(pattern(4000, period));
+    }
+    {
+        const std::string text = "the quick brown fox jumps over the lazy dog, then the quick brown fox naps";
+        cases.push_back(bytes(text.begin(), text.end()));
+    }
+    {
+        //a block of noise repeated 65535 bytes further on
+        bytes far = noise(65535 + 512);
+        std::copy(far.begin(), far.begin() + 512, far.begin() + 65535);
+        cases.push_back(far);
+        //and some noise interrupted by runs of every length around 15 and 270
+        bytes mixed;
+        for(std::size_t run : { 14, 15, 16, 18, 19, 20, 269, 270, 271, 273, 274, 275 }) {
+            auto n = noise(run);
+            mixed.insert(mixed.end(), n.begin(), n.end());
+            mixed.insert(mixed.end(), run, (std::uint8_t)run);
+        }
+        cases.push_back(mixed);
+    }
+
+    for(std::size_t k = 0; k < cases.size(); k++) {
+        const auto& raw = cases[k];
+        const auto block = compress(raw);
+        if(!decompresses_to(block, raw)) {
+            std::cerr << "Case " << k << " didn't survive a round trip!\n";
+            return 1;
+        }
+        if(raw.size() > lz4_max_decompressed_size(block.size())) {
+            std::cerr << "Case " << k << " decompresses to more than a block that size can!\n";
+            return 1;
+        }
+
+        //blocks have to fill the output exactly, no more and no less
+        bytes out(raw.size() + 1);
+        if(lz4_decompress(block.data(), block.size(), out.data(), raw.size() + 1) ||
+                (raw.size() > 0 && lz4_decompress(block.data(), block.size(), out.data(), raw.size() - 1))) {
+            std::cerr << "Case " << k << " decompressed to the wrong size!\n";
+            return 1;
+        }
+
+        //every truncation of a block that makes anything comes out short
+        for(std::size_t size = 0; raw.size() > 0 && size < block.size(); size++) {
+            if(lz4_decompress(block.data(), size, out.data(), raw.size())) {
+                std::cerr << "Case " << k << " truncated to " << size << " bytes was accepted!\n";
+                return 1;
+            }
+        }
+
+        //corrupt blocks may decompress to anything, but never out of bounds, which
+        //is what building this with a sanitizer checks
+        for(int flip = 0; flip < 200 && !block.empty(); flip++) {
+            auto corrupt = block;
+            corrupt[random() % corrupt.size()] ^= (std::uint8_t)(1 << random() % 8);
+            lz4_decompress(corrupt.data(), corrupt.size(), out.data(), raw.size());
+        }
+    }
+
+    //matches reaching back before the start of the output, or not at all
+    const std::vector<bytes> malformed {
+        { 0x10, 'a', 0x02, 0x00, 0x00 },           //offset past the start
+        { 0x10, 'a', 0x00, 0x00, 0x00 },           //offset of zero
+        { 0x10, 'a', 0x01 },                        //offset cut short
+        { 0xf0, 255, 255 },                         //literal length cut short
+        { 0x1f, 'a', 0x01, 0x00, 255 },             //match length cut short
+        { 0x50, 'a', 'b' },                         //literals cut short
+    };
+    for(std::size_t k = 0; k < malformed.size(); k++) {
+        bytes out(64);
+        for(std::size_t size = 0; size <= out.size(); size++) {
+            if(lz4_decompress(malformed[k].data(), malformed[k].size(), out.data(), size)) {
+                std::cerr << "Malformed block " << k << " was accepted!\n";
+                return 1;
+            }
+        }
+    }
+
+    std::cout << "All LZ4 tests passed (" << cases.size() << " round trips)\n";
+    return 0;
+}
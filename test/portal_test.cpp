@@ -0,0 +1,88 @@
+//build with `make test/portal_test`, which needs the game module
+#include <glm/glm.hpp>
+#include <iostream>
+#include <vector>
+
+import game;
+
+int main() {
+    using game::Scissor;
+
+    const Scissor viewport { 0, 639, 0, 479 };
+    //looking down the Z axis, like the views of the game do
+    const glm::mat4 view(1.0f);
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0), 640.0 / 480.0, 2.0, 100.0);
+
+    auto square = [](float z, float size) {
+        return std::vector<glm::vec3> {
+            glm::vec3(-size, -size, z),
+            glm::vec3( size, -size, z),
+            glm::vec3( size,  size, z),
+            glm::vec3(-size,  size, z)
+        };
+    };
+    auto contains = [](const Scissor& r, int32_t x, int32_t y) {
+        return x >= r.left && x <= r.right && y >= r.top && y <= r.bottom;
+    };
+    {
+        //a small portal straight ahead narrows the view down around the center
+        auto r = game::project_portal(square(5.0f, 0.5f), view, projection, viewport);
+        if(r.empty() || r == viewport || !contains(r, 320, 240)) {
+            std::cerr << "Portal in front didn't narrow the view!\n";
+            return 1;
+        }
+        if(r.right - r.left > 320 || r.bottom - r.top > 240) {
+            std::cerr << "Portal in front covers too much of the view!\n";
+            return 1;
+        }
+        //and a farther one even more so
+        auto far = game::project_portal(square(10.0f, 0.5f), view, projection, viewport);
+        if(far.empty() || far.right - far.left >= r.right - r.left || far.bottom - far.top >= r.bottom - r.top) {
+            std::cerr << "Farther portal isn't smaller!\n";
+            return 1;
+        }
+    }
+    {
+        //nothing can be seen through a portal behind the viewer
+        auto r = game::project_portal(square(-5.0f, 0.5f), view, projection, viewport);
+        if(!r.empty()) {
+            std::cerr << "Portal behind the viewer is visible!\n";
+            return 1;
+        }
+    }
+    {
+        //a portal reaching behind the viewer gets clipped rather than flipped,
+        //and still covers everything from its far end to the edge of the view
+        std::vector<glm::vec3> outline {
+            glm::vec3(0.5f, -1.0f, -5.0f),
+            glm::vec3(0.5f, -1.0f,  5.0f),
+            glm::vec3(0.5f,  1.0f,  5.0f),
+            glm::vec3(0.5f,  1.0f, -5.0f)
+        };
+        auto r = game::project_portal(outline, view, projection, viewport);
+        if(r.empty() || r.right - r.left < 200 || r.bottom - r.top != 479) {
+            std::cerr << "Portal reaching behind the viewer got culled!\n";
+            return 1;
+        }
+    }
+    {
+        //the cells beyond a door stay visible while walking through it, even
+        //though the door is nearer than the triangles get clipped at
+        auto r = game::project_portal(square(0.5f, 1.0f), view, projection, viewport);
+        if(!(r == viewport)) {
+            std::cerr << "Portal right in front of the viewer doesn't cover the view!\n";
+            return 1;
+        }
+    }
+    {
+        //portals keep to the viewport they are seen through
+        const Scissor column { 320, 639, 0, 479 };
+        auto r = game::project_portal(square(5.0f, 0.5f), view, projection, column);
+        if(r.empty() || !contains(r, 480, 240) || r.left < column.left) {
+            std::cerr << "Portal isn't placed in its viewport!\n";
+            return 1;
+        }
+    }
+    std::cout << "All portal tests passed\n";
+    return 0;
+}
@@ -0,0 +1,203 @@
+//compile with `c++ -I"src" -lpthread -std=c++17 test/stream_test.cpp`
+#include "stream_utils.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+
+//builds the payload of a message tile by tile
+struct message {
+    stream_header header;
+    std::vector<std::uint8_t> payload;
+
+    message(std::uint32_t width, std::uint32_t height, std::uint32_t tile) {
+        header.width = width;
+        header.height = height;
+        header.tile = tile;
+    }
+
+    void add_tile(std::uint32_t t, const std::vector<std::uint8_t>& packets) {
+        add_tile(t, packets, (std::uint32_t)packets.size());
+    }
+
+    //`size` is what the tile claims to be, which may differ from what follows it
+    void add_tile(std::uint32_t t, const std::vector<std::uint8_t>& packets, std::uint32_t size) {
+        put32(t);
+        put32(size);
+        payload.insert(payload.end(), packets.begin(), packets.end());
+        header.tiles++;
+        header.bytes = (std::uint32_t)payload.size();
+    }
+
+    void put32(std::uint32_t v) {
+        auto p = reinterpret_cast<const std::uint8_t*>(&v);
+        payload.insert(payload.end(), p, p + 4);
+    }
+};
+
+std::vector<std::uint8_t> packet(std::uint16_t p, const std::vector<std::uint32_t>& words) {
+    std::vector<std::uint8_t> out(2 + 4 * words.size());
+    std::memcpy(out.data(), &p, 2);
+    if(!words.empty()) {
+        std::memcpy(out.data() + 2, words.data(), 4 * words.size());
+    }
+    return out;
+}
+
+std::vector<std::uint8_t> operator+(std::vector<std::uint8_t> a, const std::vector<std::uint8_t>& b) {
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+bool apply(const message& m) {
+    frame_decoder d;
+    return d.apply(m.header, m.payload.data());
+}
+
+int round_trip() {
+    const std::uint32_t width = 67, height = 45, tile = 16, frames = 50;
+    thread_pool pool(4);
+    frame_streamer s(width, height, tile);
+    if(!s.listen("127.0.0.1", 0)) {
+        std::cerr << "Could not listen on the loopback interface" << std::endl;
+        return 1;
+    }
+    const int fd = stream_connect("127.0.0.1", s.port());
+    if(fd < 0) {
+        std::cerr << "Could not connect to the streamer" << std::endl;
+        return 1;
+    }
+    while(!s.connected()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::mt19937 random(119);
+    std::vector<std::uint32_t> frame(width * height, 0);
+    frame_decoder d;
+    for(std::uint32_t f = 0; f < frames; f++) {
+        //every few frames nothing changes, the rest mix flat areas, which are sent as
+        //runs, with noise, which is sent as literals, at edges that cut through tiles
+        if(f % 5 != 4) {
+            const std::uint32_t x0 = random() % width, y0 = random() % height;
+            const std::uint32_t x1 = std::min<std::uint32_t>(width, x0 + 1 + random() % 40);
+            const std::uint32_t y1 = std::min<std::uint32_t>(height, y0 + 1 + random() % 30);
+            const auto flat = (std::uint32_t)random();
+            for(auto y = y0; y < y1; y++) {
+                for(auto x = x0; x < x1; x++) {
+                    frame[y * width + x] = (x + y) % 3 ? flat : (std::uint32_t)random();
+                }
+            }
+        }
+
+        //the client reads every frame before the next one, so only a frame submitted
+        //while the last one is still being sent gets dropped, and is simply retried
+        while(!s.submit(pool, frame.data())) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if(!d.receive(fd)) {
+            std::cerr << "Frame " << f << " could not be received" << std::endl;
+            return 1;
+        }
+        if(d.width() != width || d.height() != height ||
+                std::memcmp(d.data(), frame.data(), frame.size() * sizeof(std::uint32_t)) != 0) {
+            std::cerr << "Frame " << f << " was not decoded to what was sent" << std::endl;
+            return 1;
+        }
+    }
+    ::close(fd);
+    return 0;
+}
+
+int malformed() {
+    //20x20 pixels in tiles of 16 leave 4x4 pixels in the last tile
+    const auto run = [](std::uint16_t n, std::uint32_t word) {
+        return packet(stream_detail::RUN | n, {word});
+    };
+    struct test_case {
+        const char* name;
+        message m;
+        bool valid;
+    };
+    std::vector<test_case> cases;
+    auto add = [&](const char* name, bool valid, auto&& build) {
+        message m(20, 20, 16);
+        build(m);
+        cases.push_back({name, std::move(m), valid});
+    };
+
+    add("a run over a whole tile", true, [&](message& m) {
+        m.add_tile(3, run(16, 0xdeadbeef));
+    });
+    add("a run and literals over a whole tile", true, [&](message& m) {
+        m.add_tile(3, run(14, 1) + packet(2, {2, 3}));
+    });
+    add("no tiles", true, [&](message&) {});
+    add("a run past the end of the tile", false, [&](message& m) {
+        m.add_tile(3, run(17, 1));
+    });
+    add("literals past the end of the tile", false, [&](message& m) {
+        m.add_tile(3, run(15, 1) + packet(2, {2, 3}));
+    });
+    add("a run missing its word", false, [&](message& m) {
+        auto p = run(16, 1);
+        p.resize(4);
+        m.add_tile(3, p);
+    });
+    add("truncated literals", false, [&](message& m) {
+        m.add_tile(3, packet(16, std::vector<std::uint32_t>(15, 7)));
+    });
+    add("a tile left partly unwritten", false, [&](message& m) {
+        m.add_tile(3, run(15, 1));
+    });
+    add("a byte after the last packet", false, [&](message& m) {
+        m.add_tile(3, run(16, 1) + std::vector<std::uint8_t>{0});
+    });
+    add("a tile out of range", false, [&](message& m) {
+        m.add_tile(4, run(16, 1));
+    });
+    add("a tile larger than the message", false, [&](message& m) {
+        m.add_tile(3, run(16, 1), 7);
+    });
+    add("fewer tiles than the header counts", false, [&](message& m) {
+        m.add_tile(3, run(16, 1));
+        m.header.tiles++;
+    });
+    add("bytes after the last tile", false, [&](message& m) {
+        m.add_tile(3, run(16, 1));
+        m.payload.push_back(0);
+        m.header.bytes++;
+    });
+    add("a tile size of zero", false, [&](message& m) {
+        m.add_tile(3, run(16, 1));
+        m.header.tile = 0;
+    });
+    add("a bad magic", false, [&](message& m) {
+        m.add_tile(3, run(16, 1));
+        m.header.magic = 0;
+    });
+
+    for(auto& c : cases) {
+        if(apply(c.m) != c.valid) {
+            std::cerr << "Message with " << c.name << " was " << (c.valid ? "rejected" : "accepted") << std::endl;
+            return 1;
+        }
+    }
+
+    //the pixels of a tile land where they belong
+    message m(20, 20, 16);
+    m.add_tile(3, run(14, 1) + packet(2, {2, 3}));
+    frame_decoder d;
+    if(!d.apply(m.header, m.payload.data()) || d.data()[16 * 20 + 16] != 1 ||
+            d.data()[19 * 20 + 18] != 2 || d.data()[19 * 20 + 19] != 3 || d.data()[15 * 20 + 15] != 0) {
+        std::cerr << "Tile was decoded to the wrong pixels" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main() {
+    if(malformed() != 0 || round_trip() != 0) {
+        return 1;
+    }
+    std::cerr << "All stream tests passed" << std::endl;
+    return 0;
+}
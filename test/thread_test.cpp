@@ -86,4 +86,170 @@ int main() {
             return 1;
         }
     }
+    {
+        //jobs are owned by the caller and don't allocate when submitted, use
+        //a wait_group to wait for them instead of futures
+        std::atomic<std::uint32_t> sum { 0 };
+        wait_group group;
+        auto job_fn = [&](std::uint32_t id) {
+            sum.fetch_add(id + 1);
+            group.done();
+        };
+        group.add(p.size());
+        for(auto i = 0u; i < p.size(); i++) {
+            p.submit_job_for(i, make_job(job_fn));
+        }
+        group.wait();
+        const auto expected = p.size() * (p.size() + 1) / 2;
+        locked_print(std::cout, "Job sum = ", sum.load(), " (should be ", expected, ")\n");
+        if(sum.load() != expected) {
+            locked_print(std::cerr, "Jobs ran in the wrong threads!\n");
+            return 1;
+        }
+    }
+    {
+        //an elastic pool keeps all of its threads around, but only hands work to
+        //as many of them as it needs to fit the work in the given budget
+        thread_pool e(1, 4);
+        if(e.active() != 1 || e.max_size() != 4) {
+            locked_print(std::cerr, "Elastic pool started with the wrong bounds!\n");
+            return 1;
+        }
+        //a second of work can't fit in 100ms with one thread, so the pool
+        //should wake all of them up
+        auto v = std::vector<std::future<int>>();
+        for(auto i = 0; i < 4; i++) {
+            v.push_back(e.submit_task(make_task<int>([i]() {
+                sleepms(250);
+                return i;
+            })));
+        }
+        for(auto& f : v) {
+            f.get();
+        }
+        auto active = e.adapt(std::chrono::milliseconds(100));
+        locked_print(std::cout, "Active threads after heavy work = ", active, " (should be 4)\n");
+        if(active != 4) {
+            locked_print(std::cerr, "Elastic pool didn't grow!\n");
+            return 1;
+        }
+        //without any work, it should park one thread per call, down to the minimum
+        for(auto i = 0; i < 8; i++) {
+            active = e.adapt(std::chrono::milliseconds(100));
+        }
+        locked_print(std::cout, "Active threads after idling = ", active, " (should be 1)\n");
+        if(active != 1) {
+            locked_print(std::cerr, "Elastic pool didn't shrink!\n");
+            return 1;
+        }
+        //parked threads never get jobs submitted to any thread
+        std::atomic<std::uint32_t> misplaced { 0 };
+        wait_group group;
+        auto job_fn = [&](std::uint32_t id) {
+            if(id >= 1) misplaced.fetch_add(1);
+            group.done();
+        };
+        group.add(16);
+        for(auto i = 0; i < 16; i++) {
+            e.submit_job(make_job(job_fn));
+        }
+        group.wait();
+        if(misplaced.load() != 0) {
+            locked_print(std::cerr, "Parked threads got work!\n");
+            return 1;
+        }
+    }
+    {
+        //jobs in a cancelled group don't run, but still count as done, so
+        //waiting on the group returns as soon as the running ones stop
+        std::atomic<std::uint32_t> ran { 0 };
+        task_group group;
+        auto job_fn = [&](std::uint32_t id) {
+            (void)id;
+            //long jobs poll the group at safe points
+            for(auto i = 0; i < 10 && !group.cancelled(); i++) {
+                sleepms(100);
+            }
+            ran.fetch_add(1);
+        };
+        group.add(16);
+        for(auto i = 0; i < 16; i++) {
+            p.submit_job_for(0, make_job(job_fn, group));
+        }
+        auto begin = std::chrono::steady_clock::now();
+        sleepms(50);
+        group.cancel();
+        group.wait();
+        auto end = std::chrono::steady_clock::now();
+        auto time = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
+        locked_print(std::cout, "Cancelled jobs ran = ", ran.load(), " (should be 1), in ", time, "ms\n");
+        if(ran.load() != 1 || time > 500) {
+            locked_print(std::cerr, "Cancelling didn't drop the queued jobs!\n");
+            return 1;
+        }
+        //dropped tasks break their promises
+        group.reset();
+        group.add(1);
+        group.cancel();
+        auto f = p.submit_task<int>([](std::uint32_t) { return 1; }, group);
+        group.wait();
+        try {
+            f.get();
+            locked_print(std::cerr, "Cancelled task ran!\n");
+            return 1;
+        } catch(const std::future_error&) {
+            locked_print(std::cout, "Cancelled task was dropped\n");
+        }
+    }
+    {
+        //timers run tasks on the pool at a given time, without a thread of their own
+        using clock = std::chrono::steady_clock;
+        std::promise<clock::time_point> fired;
+        const auto deadline = clock::now() + std::chrono::milliseconds(50);
+        p.schedule_at(deadline, [&fired](std::uint32_t) {
+            fired.set_value(clock::now());
+        });
+        const auto late = std::chrono::duration_cast<std::chrono::microseconds>(fired.get_future().get() - deadline).count();
+        locked_print(std::cout, "Timer fired ", late, "us late\n");
+        if(late < 0 || late > 20000) {
+            locked_print(std::cerr, "Timer fired at the wrong time!\n");
+            return 1;
+        }
+
+        //periodic timers keep running until they're cancelled, and cancelled ones
+        //never run
+        std::atomic<std::uint32_t> ticks { 0 };
+        auto every = p.schedule_every(std::chrono::milliseconds(10), [&ticks](std::uint32_t) {
+            ticks.fetch_add(1);
+        });
+        auto never = p.schedule_after(std::chrono::milliseconds(20), [&ticks](std::uint32_t) {
+            ticks.fetch_add(1000);
+        });
+        p.cancel_timer(never);
+        sleepms(105);
+        p.cancel_timer(every);
+        const auto count = ticks.load();
+        sleepms(30);
+        locked_print(std::cout, "Periodic timer ran ", count, " times (should be 10)\n");
+        if(count < 9 || count > 10 || ticks.load() != count) {
+            locked_print(std::cerr, "Periodic timer ran the wrong number of times!\n");
+            return 1;
+        }
+
+        //timers can also be run by the timer thread itself, leaving the workers alone
+        std::promise<std::pair<std::uint32_t, bool>> ran;
+        std::atomic<bool> once { false };
+        auto own = p.schedule_every(std::chrono::milliseconds(10), [&](std::uint32_t id) {
+            if(!once.exchange(true)) {
+                ran.set_value({ id, p.current_tid().has_value() });
+            }
+        }, true);
+        const auto [id, on_worker] = ran.get_future().get();
+        p.cancel_timer(own);
+        if(id != p.max_size() || on_worker) {
+            locked_print(std::cerr, "Timer meant for the timer thread ran on a worker!\n");
+            return 1;
+        }
+        locked_print(std::cout, "Timer ran on the timer thread\n");
+    }
 }